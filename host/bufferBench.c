@@ -0,0 +1,137 @@
+/**
+ * @file bufferBench.c
+ * @author Space Concordia Rocket Division
+ * @brief Host benchmark of the circularBuffer enqueue/dequeue throughput.
+ *
+ * The current buffer_enqueue()/buffer_dequeue() are compared to the previous byte per byte
+ * implementation, kept here as legacyEnqueue()/legacyDequeue(). The legacy capacity uses the
+ * corrected formula, the original one underflowed and never reported the buffer full.
+ *
+ * Each run pushes BENCH_BYTES through the buffer in chunks, the same sequence of random bytes is
+ * then checked against a random mix of both implementations to verify the data is identical.
+ * The exit status is 1 on a mismatch.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "circularBuffer.h"
+#include "sysTimerHost.h"
+
+#define BENCH_BYTES (64u * 1024u * 1024u)
+#define CHECK_OPERATIONS 200000
+#define MAX_ARRAY_SIZE 1024
+
+static uint8_t array[MAX_ARRAY_SIZE];
+static uint8_t legacyArray[MAX_ARRAY_SIZE];
+static uint8_t chunkIn[MAX_ARRAY_SIZE];
+static uint8_t chunkOut[MAX_ARRAY_SIZE];
+static uint8_t legacyOut[MAX_ARRAY_SIZE];
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom(void) {
+	randomState = randomState * 1103515245u + 12345u;
+	return (randomState >> 16) & 0x7FFF;
+}
+
+static size_t legacyRemainingCapacity(struct circularBuffer * buffer) {
+	return (buffer->arraySize - 1 - (buffer->arraySize - buffer->front + buffer->back) % buffer->arraySize);
+}
+
+static size_t legacySize(struct circularBuffer * buffer) {
+	return (buffer->arraySize - buffer->front + buffer->back) % buffer->arraySize;
+}
+
+static size_t legacyEnqueue(struct circularBuffer * buffer, uint8_t * elements, size_t count) {
+	size_t i;
+	for (i = 0; i < count && legacyRemainingCapacity(buffer) > 0; i++) {
+		buffer->mem[buffer->back] = elements[i];
+		buffer->back = (buffer->back + 1) % buffer->arraySize;
+	}
+	return i;
+}
+
+static size_t legacyDequeue(struct circularBuffer * buffer, uint8_t * out, size_t count) {
+	size_t i;
+	for (i = 0; i < count && legacySize(buffer) > 0; i++) {
+		out[i] = buffer->mem[buffer->front];
+		buffer->front = (buffer->front + 1) % buffer->arraySize;
+	}
+	return i;
+}
+
+static double throughput(size_t arraySize, size_t chunk, bool legacy) {
+	struct circularBuffer buffer;
+	buffer_attachArray(&buffer, array, arraySize);
+
+	uint64_t start = sysTimerHost_nanos();
+	for (size_t moved = 0; moved < BENCH_BYTES; moved += chunk) {
+		if (legacy) {
+			legacyEnqueue(&buffer, chunkIn, chunk);
+			legacyDequeue(&buffer, chunkOut, chunk);
+		} else {
+			buffer_enqueue(&buffer, chunkIn, chunk);
+			buffer_dequeue(&buffer, chunkOut, chunk);
+		}
+	}
+	uint64_t elapsed = sysTimerHost_nanos() - start;
+
+	// MB/s, each byte is enqueued and dequeued
+	return (double) BENCH_BYTES * 1000.0 / (double) elapsed;
+}
+
+static bool check(size_t arraySize) {
+	struct circularBuffer buffer;
+	struct circularBuffer legacy;
+	buffer_attachArray(&buffer, array, arraySize);
+	buffer_attachArray(&legacy, legacyArray, arraySize);
+
+	for (int i = 0; i < CHECK_OPERATIONS; i++) {
+		size_t count = nextRandom() % arraySize + 1;
+		if (nextRandom() % 2) {
+			for (size_t j = 0; j < count; j++) {
+				chunkIn[j] = (uint8_t) nextRandom();
+			}
+			if (buffer_enqueue(&buffer, chunkIn, count) != legacyEnqueue(&legacy, chunkIn, count)) {
+				return false;
+			}
+		} else {
+			size_t outCount = buffer_dequeue(&buffer, chunkOut, count);
+			if (outCount != legacyDequeue(&legacy, legacyOut, count)
+					|| memcmp(chunkOut, legacyOut, outCount) != 0) {
+				return false;
+			}
+		}
+		if (buffer_size(&buffer) != legacySize(&legacy)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(void) {
+	const size_t arraySizes[] = {256, 250, 1024};
+	const size_t chunks[] = {1, 8, 64, 200};
+	bool passed = true;
+
+	printf("%6s %6s %12s %12s %8s\n", "array", "chunk", "legacy MB/s", "MB/s", "speedup");
+	for (size_t i = 0; i < sizeof(arraySizes) / sizeof(arraySizes[0]); i++) {
+		for (size_t j = 0; j < sizeof(chunks) / sizeof(chunks[0]); j++) {
+			if (chunks[j] >= arraySizes[i]) {
+				continue;
+			}
+			double legacy = throughput(arraySizes[i], chunks[j], true);
+			double current = throughput(arraySizes[i], chunks[j], false);
+			printf("%6zu %6zu %12.1f %12.1f %7.1fx\n", arraySizes[i], chunks[j], legacy, current, current / legacy);
+		}
+
+		if (!check(arraySizes[i])) {
+			printf("FAILED: array %zu doesn't match the legacy implementation\n", arraySizes[i]);
+			passed = false;
+		}
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,253 @@
+/**
+ * @file bufferStress.c
+ * @author Space Concordia Rocket Division
+ * @brief Two thread stress test of the circularBuffer single producer/single consumer contract.
+ *
+ * The producer thread stands in for an interrupt handler and enqueues a counting byte sequence in
+ * random chunks with buffer_enqueue(). The consumer thread stands in for the main loop and checks the
+ * sequence, with buffer_dequeue() in the first half of the run and the peekLinear()/advanceLinear()
+ * pair like the UART transmit path in the second half.
+ * Neither side takes a lock.
+ *
+ * A second run sets BUFFER_POLICY_OVERWRITE_OLDEST with '\n' records and a producer faster than the
+ * consumer, the consumer checks that every line received is whole and newer than the previous one.
+ * Half of the lines are written in 3 segments with buffer_enqueuev().
+ *
+ * Usage: bufferStress [megabytes]
+ * 	The exit status is 1 if a byte is lost, duplicated or reordered, or if a line is cut or reordered
+ * 	in the overwrite run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "circularBuffer.h"
+#include "sysTimerHost.h"
+
+#define ARRAY_SIZE 250 // not a power of 2 to test the generic wrap
+#define MAX_CHUNK 64
+#define RECORD_PAYLOAD_MAX 48
+#define RECORD_SIZE_MAX (8 + RECORD_PAYLOAD_MAX + 1)
+
+static struct circularBuffer buffer;
+static uint8_t array[ARRAY_SIZE];
+static uint64_t totalBytes;
+static volatile bool failed = false;
+static volatile bool producerDone = false;
+
+static uint32_t nextRandom(uint32_t * state) {
+	*state = *state * 1103515245u + 12345u;
+	return (*state >> 16) & 0x7FFF;
+}
+
+static void * producer(void * arg) {
+	uint32_t randomState = 1;
+	uint8_t chunk[MAX_CHUNK];
+	uint8_t next = 0;
+	uint64_t sent = 0;
+
+	while (sent < totalBytes && !failed) {
+		size_t count = nextRandom(&randomState) % MAX_CHUNK + 1;
+		if (count > totalBytes - sent) {
+			count = totalBytes - sent;
+		}
+		for (size_t i = 0; i < count; i++) {
+			chunk[i] = (uint8_t) (next + i);
+		}
+
+		size_t written = buffer_enqueue(&buffer, chunk, count);
+		next += written;
+		sent += written;
+		if (written == 0) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+static bool checkBytes(uint8_t * data, size_t count, uint8_t * expected) {
+	for (size_t i = 0; i < count; i++) {
+		if (data[i] != *expected) {
+			return false;
+		}
+		(*expected)++;
+	}
+	return true;
+}
+
+static void * consumer(void * arg) {
+	uint32_t randomState = 2;
+	uint8_t chunk[MAX_CHUNK];
+	uint8_t expected = 0;
+	uint64_t received = 0;
+
+	while (received < totalBytes && !failed) {
+		size_t count;
+		if (received < totalBytes / 2) {
+			count = buffer_dequeue(&buffer, chunk, nextRandom(&randomState) % MAX_CHUNK + 1);
+			if (!checkBytes(chunk, count, &expected)) {
+				failed = true;
+			}
+		} else {
+			uint8_t * data;
+			count = buffer_peekLinear(&buffer, &data);
+			if (!checkBytes(data, count, &expected)) {
+				failed = true;
+			}
+			buffer_advanceLinear(&buffer);
+		}
+
+		received += count;
+		if (count == 0) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/*
+ * A record is the hex sequence number, a payload derived from it and '\n'.
+ */
+static size_t formatRecord(uint32_t sequence, uint8_t * record) {
+	size_t payloadSize = sequence % RECORD_PAYLOAD_MAX;
+	sprintf((char *) record, "%08" PRIx32, sequence);
+	for (size_t i = 0; i < payloadSize; i++) {
+		record[8 + i] = (uint8_t) ('a' + (sequence + i) % 26);
+	}
+	record[8 + payloadSize] = '\n';
+	return 8 + payloadSize + 1;
+}
+
+static void * recordProducer(void * arg) {
+	uint64_t records = *(uint64_t *) arg;
+	uint8_t record[RECORD_SIZE_MAX];
+
+	for (uint32_t sequence = 0; sequence < records && !failed; sequence++) {
+		size_t size = formatRecord(sequence, record);
+		if (sequence % 2) {
+			buffer_enqueue(&buffer, record, size);
+		} else {
+			// the sequence number, the payload and '\n' as separate segments
+			struct buffer_segment segments[] = {
+				{record, 8}, {record + 8, size - 9}, {record + size - 1, 1},
+			};
+			buffer_enqueuev(&buffer, segments, 3);
+		}
+		// only a few times faster than the consumer so most lines still go through
+		if (sequence % 4 == 0) {
+			sched_yield();
+		}
+	}
+	producerDone = true;
+	return NULL;
+}
+
+/*
+ * Returns the received count of records, 0 on a failure.
+ */
+static uint64_t receiveRecords(void) {
+	uint32_t randomState = 3;
+	uint8_t line[RECORD_SIZE_MAX];
+	uint8_t expected[RECORD_SIZE_MAX];
+	uint8_t chunk[MAX_CHUNK];
+	size_t lineSize = 0;
+	int64_t lastSequence = -1;
+	uint64_t received = 0;
+
+	while (!(producerDone && buffer_size(&buffer) == 0)) {
+		uint8_t * data;
+		size_t count;
+		bool linear = nextRandom(&randomState) % 2;
+		if (linear) {
+			count = buffer_peekLinear(&buffer, &data);
+			// the transfer of the peeked data takes some time like the UART transmit
+			if (nextRandom(&randomState) % 4 == 0) {
+				sched_yield();
+			}
+		} else {
+			count = buffer_dequeue(&buffer, chunk, nextRandom(&randomState) % MAX_CHUNK + 1);
+			data = chunk;
+		}
+
+		for (size_t i = 0; i < count; i++) {
+			if (lineSize >= RECORD_SIZE_MAX) {
+				return 0;
+			}
+			line[lineSize++] = data[i];
+			if (data[i] != '\n') {
+				continue;
+			}
+
+			char hex[9];
+			memcpy(hex, line, 8);
+			hex[8] = '\0';
+			uint32_t sequence = strtoul(hex, NULL, 16);
+			if ((int64_t) sequence <= lastSequence || formatRecord(sequence, expected) != lineSize
+					|| memcmp(line, expected, lineSize) != 0) {
+				return 0;
+			}
+			lastSequence = sequence;
+			received++;
+			lineSize = 0;
+		}
+		if (linear) {
+			buffer_advanceLinear(&buffer);
+		}
+		if (count == 0) {
+			sched_yield();
+		}
+	}
+	return (lineSize == 0) ? received : 0;
+}
+
+static bool overwriteRun(uint64_t records) {
+	buffer_attachArray(&buffer, array, ARRAY_SIZE);
+	buffer_setPolicy(&buffer, BUFFER_POLICY_OVERWRITE_OLDEST, '\n');
+	producerDone = false;
+
+	pthread_t producerThread;
+	pthread_create(&producerThread, NULL, recordProducer, &records);
+	uint64_t received = receiveRecords();
+	if (received == 0) {
+		failed = true;
+	}
+	pthread_join(producerThread, NULL);
+
+	struct buffer_stats stats;
+	buffer_getStats(&buffer, &stats);
+	if (failed) {
+		printf("FAILED: a line was cut or reordered with overwrite oldest\n");
+		return false;
+	}
+	printf("%" PRIu64 " lines received of %" PRIu64 ", %" PRIu32 " bytes dropped, %" PRIu32 " writes dropped, peak %zu\n",
+			received, records, stats.droppedBytes, stats.droppedWrites, stats.peakSize);
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	uint64_t megabytes = (argc > 1) ? strtoull(argv[1], NULL, 10) : 16;
+	totalBytes = megabytes * 1024 * 1024;
+	buffer_attachArray(&buffer, array, ARRAY_SIZE);
+
+	pthread_t producerThread;
+	pthread_t consumerThread;
+	uint64_t start = sysTimerHost_nanos();
+	pthread_create(&consumerThread, NULL, consumer, NULL);
+	pthread_create(&producerThread, NULL, producer, NULL);
+	pthread_join(producerThread, NULL);
+	pthread_join(consumerThread, NULL);
+	uint64_t elapsed = sysTimerHost_nanos() - start;
+
+	if (failed || buffer_size(&buffer) != 0) {
+		printf("FAILED: the consumer didn't receive the producer sequence\n");
+		return 1;
+	}
+	printf("%" PRIu64 " MB through a %d byte buffer in %.2f s\n", megabytes, ARRAY_SIZE, elapsed / 1e9);
+
+	return overwriteRun(megabytes * 32 * 1024) ? 0 : 1;
+}
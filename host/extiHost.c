@@ -0,0 +1,62 @@
+/**
+ * @file extiHost.c
+ * @author Space Concordia Rocket Division
+ * @brief Simulated interrupt implementation of exti.h for the host build.
+ */
+
+#include <stddef.h>
+
+#include "extiHost.h"
+#include "scheduler.h"
+#include "sysTimer.h"
+
+struct exti_line {
+	void (*vector)(uint32_t, void *);
+	void * argument;
+	uint8_t priority;
+	uint32_t droppedCount;
+};
+
+static struct exti_line lines[EXTI_LINES_COUNT];
+static bool openFails = false;
+
+// The port and the edge are the concern of the simulated source.
+bool exti_open(enum exti_port port, uint8_t line, enum exti_edge edge, void (*vector)(uint32_t, void *),
+		void * argument, uint8_t priority) {
+	if (openFails || line >= EXTI_LINES_COUNT || port > EXTI_PORT_D || vector == NULL) {
+		return false;
+	}
+
+	lines[line].vector = vector;
+	lines[line].argument = argument;
+	lines[line].priority = priority;
+	lines[line].droppedCount = 0;
+	return true;
+}
+
+void exti_close(uint8_t line) {
+	if (line < EXTI_LINES_COUNT) {
+		lines[line].vector = NULL;
+	}
+}
+
+uint32_t exti_getDroppedCount(uint8_t line) {
+	return (line < EXTI_LINES_COUNT) ? lines[line].droppedCount : 0;
+}
+
+void extiHost_setOpenFails(bool fails) {
+	openFails = fails;
+}
+
+bool extiHost_raise(uint8_t line) {
+	if (line >= EXTI_LINES_COUNT || lines[line].vector == NULL) {
+		return false;
+	}
+
+	struct exti_line * extiLine = &lines[line];
+	if (!scheduler_postEvent(extiLine->vector, sysTimer_GetMicros(), extiLine->argument, extiLine->priority)) {
+		extiLine->droppedCount++;
+		return false;
+	}
+	return true;
+}
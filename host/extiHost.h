@@ -0,0 +1,30 @@
+/**
+ * @file extiHost.h
+ * @author Space Concordia Rocket Division
+ * @brief Simulated interrupt implementation of exti.h for the host build.
+ * 
+ * There are no pins on the host, the program raises the edges of an opened line with extiHost_raise(),
+ * usually from the raise function of a sysTimerHost interrupt source so they come at their own time.
+ */
+
+#ifndef EXTIHOST_H_
+#define EXTIHOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "exti.h"
+
+/**
+ * @brief Run the interrupt of line like exti.c, the event is sysTimer_GetMicros() at the call.
+ * 
+ * @return false if the line isn't opened or its event was dropped.
+ */
+bool extiHost_raise(uint8_t line);
+
+/**
+ * @brief Make the next exti_open() calls fail, eg. to run the drivers on their polling fallback.
+ */
+void extiHost_setOpenFails(bool fails);
+
+#endif /* EXTIHOST_H_ */
@@ -0,0 +1,262 @@
+/**
+ * @file extiSim.c
+ * @author Space Concordia Rocket Division
+ * @brief Virtual time simulation of the sensor data ready interrupts against the polling tasks.
+ *
+ * Each source stands in for a sensor interrupt pin with an edge every period, the barometer data ready
+ * at the conversion time and the accelerometer FIFO watermark. The edges are raised through extiHost.c by
+ * the sysTimerHost interrupt source, at their own tick even when a task is running, while the flight
+ * task set of schedulerSim keeps the main loop busy.
+ *
+ * The same load runs in two modes:
+ * 	-poll: the driver task reads every POLL_INTERVAL_MS and timestamps the sample with the time of
+ * 	the read, like the drivers before the interrupts.
+ * 	-interrupt: the handler of the exti event reads, with the event as the timestamp. The poll task only
+ * 	reads when no edge was handled during its interval, like the drivers.
+ * The age is the virtual time from the edge to the read, the timestamp error is the difference between
+ * the timestamp given to the sample and its edge.
+ *
+ * Usage: extiSim
+ * 	The exit status is 1 if in the interrupt mode an edge is lost, a timestamp isn't the time of its
+ * 	edge or the age goes over AGE_MAX_MS.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+#include "sysTimerHost.h"
+#include "extiHost.h"
+
+#define SIM_DURATION_MS 60000
+#define POLL_INTERVAL_MS 50
+#define AGE_MAX_MS 10 // the longest task of the load is 3 ms
+
+struct simSource {
+	const char * name;
+	uint8_t line;
+	uint32_t period;
+	uint8_t priority;
+	uint32_t nextEdge;
+	uint32_t lastEdge;
+	uint32_t lastReadEdge; // edge of the last sample read
+	uint32_t handledEdge; // edge of the last exti event
+	uint32_t edgeCount;
+	uint32_t readCount;
+	uint32_t pollReadCount;
+	uint32_t badTimestampCount;
+	bool readSincePoll;
+	uint32_t ageMax;
+	uint64_t ageTotal;
+	uint32_t errorMax;
+	struct task * pollTask;
+};
+
+struct simLoad {
+	uint32_t period;
+	uint32_t runTimeMin;
+	uint32_t runTimeMax;
+	uint8_t priority;
+	struct task * task;
+};
+
+static struct simSource sources[] = {
+	{"barometer", 0, 34, 3}, // MPL3115A2 OS8 conversion
+	{"accel fifo", 1, 40, 2}, // LSM303DLHC watermark of 16 samples at 400 Hz
+};
+
+// the flight set of schedulerSim without the sensors
+static struct simLoad loads[] = {
+	{20, 0, 1, 4}, // pitot
+	{20, 0, 0, 5}, // commands
+	{50, 2, 3, 1}, // telemetry
+	{500, 0, 0, 7}, // blink
+};
+
+#define SOURCES_COUNT (sizeof(sources) / sizeof(sources[0]))
+#define LOADS_COUNT (sizeof(loads) / sizeof(loads[0]))
+
+static bool interruptMode;
+static uint32_t simEnd;
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom(void) {
+	randomState = randomState * 1103515245u + 12345u;
+	return (randomState >> 16) & 0x7FFF;
+}
+
+static bool nextEdge(uint32_t * micros) {
+	uint32_t next = sources[0].nextEdge;
+	for (size_t i = 1; i < SOURCES_COUNT; i++) {
+		if ((int32_t) (sources[i].nextEdge - next) < 0) {
+			next = sources[i].nextEdge;
+		}
+	}
+	*micros = next * 1000;
+	return true;
+}
+
+static void raiseEdges(void) {
+	uint32_t now = sysTimer_GetTick();
+	for (size_t i = 0; i < SOURCES_COUNT; i++) {
+		struct simSource * source = &sources[i];
+		if ((int32_t) (source->nextEdge - now) > 0) {
+			continue;
+		}
+		source->lastEdge = source->nextEdge;
+		source->nextEdge += source->period;
+		source->edgeCount++;
+		if (interruptMode) {
+			extiHost_raise(source->line);
+		}
+	}
+}
+
+/*
+ * The sample of the edge is read at the current time with timestamp.
+ */
+static void readSample(struct simSource * source, uint32_t edge, uint32_t timestampMicros) {
+	uint32_t nowMicros = sysTimer_GetMicros();
+	uint32_t edgeMicros = edge * 1000;
+	uint32_t age = (nowMicros - edgeMicros) / 1000;
+	uint32_t error = (timestampMicros > edgeMicros) ? timestampMicros - edgeMicros : edgeMicros - timestampMicros;
+
+	source->lastReadEdge = edge;
+	source->readCount++;
+	source->ageTotal += age;
+	if (age > source->ageMax) {
+		source->ageMax = age;
+	}
+	if (error > source->errorMax) {
+		source->errorMax = error;
+	}
+}
+
+static void dataReady(uint32_t event, void * arg) {
+	struct simSource * source = arg;
+
+	// every edge is handled in order, the event must be the time of the next one
+	uint32_t expected = source->handledEdge + source->period;
+	if (event != expected * 1000) {
+		source->badTimestampCount++;
+	}
+	source->handledEdge = expected;
+	source->readSincePoll = true;
+	// the poll task can run first when its release is at the same tick
+	if (source->readCount == 0 || source->lastReadEdge != expected) {
+		readSample(source, expected, event);
+	}
+}
+
+static void pollRun(uint32_t event, void * arg) {
+	struct simSource * source = arg;
+
+	if (source->readSincePoll) {
+		source->readSincePoll = false;
+		return;
+	}
+	// no new sample since the last read
+	if (source->edgeCount == 0 || (source->readCount > 0 && source->lastReadEdge == source->lastEdge)) {
+		return;
+	}
+	if (interruptMode) {
+		source->pollReadCount++;
+	}
+	readSample(source, source->lastEdge, sysTimer_GetMicros());
+}
+
+static void loadRun(uint32_t event, void * arg) {
+	struct simLoad * load = arg;
+	uint32_t runTime = load->runTimeMin;
+	if (load->runTimeMax > load->runTimeMin) {
+		runTime += nextRandom() % (load->runTimeMax - load->runTimeMin + 1);
+	}
+	sysTimerHost_advance(runTime);
+}
+
+// runs once when created and once at the end of the simulation
+static void simStop(uint32_t event, void * arg) {
+	if ((int32_t) (sysTimer_GetTick() - simEnd) < 0) {
+		return;
+	}
+	scheduler_exit();
+}
+
+static bool simulate(bool interrupts) {
+	interruptMode = interrupts;
+	sysTimerHost_setAutoAdvance(0);
+	sysTimerHost_setTick(0);
+	randomState = 1;
+	simEnd = SIM_DURATION_MS;
+
+	for (size_t i = 0; i < SOURCES_COUNT; i++) {
+		struct simSource * source = &sources[i];
+		source->nextEdge = source->period;
+		source->lastEdge = 0;
+		source->lastReadEdge = 0;
+		source->handledEdge = 0;
+		source->edgeCount = 0;
+		source->readCount = 0;
+		source->pollReadCount = 0;
+		source->badTimestampCount = 0;
+		source->readSincePoll = false;
+		source->ageMax = 0;
+		source->ageTotal = 0;
+		source->errorMax = 0;
+		if (interrupts) {
+			exti_open(EXTI_PORT_B, source->line, EXTI_EDGE_RISING, dataReady, source, source->priority);
+		}
+		source->pollTask = createTask(pollRun, 0, source, POLL_INTERVAL_MS, true, source->priority);
+		scheduler_setPeriodMode(source->pollTask, SCHEDULER_PERIOD_DEADLINE_SKIP);
+	}
+	for (size_t i = 0; i < LOADS_COUNT; i++) {
+		loads[i].task = createTask(loadRun, 0, &loads[i], loads[i].period, true, loads[i].priority);
+		scheduler_setPeriodMode(loads[i].task, SCHEDULER_PERIOD_DEADLINE_SKIP);
+	}
+	struct task * stopTask = createTask(simStop, 0, NULL, SIM_DURATION_MS, true, 0);
+	scheduler_setPeriodMode(stopTask, SCHEDULER_PERIOD_DEADLINE_SKIP);
+
+	sysTimerHost_addInterruptSource(nextEdge, raiseEdges);
+	runScheduler();
+	sysTimerHost_removeInterruptSource(raiseEdges);
+
+	printf("%s: %u ms, poll every %u ms\n", interrupts ? "interrupt" : "poll", SIM_DURATION_MS,
+			POLL_INTERVAL_MS);
+	printf("%-11s %6s %6s %6s %6s %6s %8s %8s %8s\n", "source", "period", "edges", "reads", "polled", "lost",
+			"ageMean", "ageMax", "errMaxUs");
+
+	bool passed = true;
+	for (size_t i = 0; i < SOURCES_COUNT; i++) {
+		struct simSource * source = &sources[i];
+		uint32_t lost = source->edgeCount - source->readCount;
+		printf("%-11s %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %8.2f %8" PRIu32 " %8" PRIu32
+				"\n", source->name, source->period, source->edgeCount, source->readCount, source->pollReadCount, lost,
+				(source->readCount > 0) ? (double) source->ageTotal / source->readCount : 0.0, source->ageMax,
+				source->errorMax);
+
+		if (interrupts) {
+			// the last edge can still be queued at the stop
+			if (lost > 1 || exti_getDroppedCount(source->line) > 0 || source->badTimestampCount > 0
+					|| source->errorMax > 0 || source->ageMax > AGE_MAX_MS) {
+				printf("FAILED: %s lost %" PRIu32 " edges, %" PRIu32 " wrong timestamps\n", source->name, lost,
+						source->badTimestampCount);
+				passed = false;
+			}
+			exti_close(source->line);
+		}
+		destroyTask(source->pollTask);
+	}
+	for (size_t i = 0; i < LOADS_COUNT; i++) {
+		destroyTask(loads[i].task);
+	}
+	destroyTask(stopTask);
+	printf("\n");
+
+	return passed;
+}
+
+int main(int argc, char ** argv) {
+	simulate(false);
+	return simulate(true) ? 0 : 1;
+}
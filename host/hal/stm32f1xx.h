@@ -0,0 +1,12 @@
+/**
+ * @file stm32f1xx.h
+ * @author Space Concordia Rocket Division
+ * @brief Host stand-in of the device header, only what the hardware independent drivers use.
+ */
+
+#ifndef __STM32F1XX_H
+#define __STM32F1XX_H
+
+#include "stm32f1xx_hal.h"
+
+#endif /* __STM32F1XX_H */
@@ -0,0 +1,69 @@
+/**
+ * @file stm32f1xx_hal.h
+ * @author Space Concordia Rocket Division
+ * @brief Host stand-in of the hal header, only what the hardware independent drivers use.
+ *
+ * The sensor drivers include i2c.h and main.h for their types and constants, the hal itself is replaced
+ * by the host implementations of the modules (extiHost.c, sysTimerHost.c). i2c.c is built unchanged,
+ * the I2C part of the hal it calls is implemented by i2cHost.c on the simulated buses.
+ */
+
+#ifndef __STM32F1xx_HAL_H
+#define __STM32F1xx_HAL_H
+
+#include <stdint.h>
+
+#define UNUSED(x) ((void)(x))
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+#define I2C_MEMADD_SIZE_8BIT            ((uint32_t)0x00000001)
+#define I2C_MEMADD_SIZE_16BIT           ((uint32_t)0x00000010)
+
+#define I2C_DUTYCYCLE_2                 ((uint32_t)0x00000000)
+#define I2C_ADDRESSINGMODE_7BIT         ((uint32_t)0x00004000)
+#define I2C_ADDRESSINGMODE_10BIT        ((uint32_t)0x0000C000)
+#define I2C_DUALADDRESS_DISABLE         ((uint32_t)0x00000000)
+#define I2C_GENERALCALL_DISABLE         ((uint32_t)0x00000000)
+#define I2C_NOSTRETCH_DISABLE           ((uint32_t)0x00000000)
+
+// the instance of a handle is the simulated bus of i2cHost.c
+typedef struct i2cHost_bus I2C_TypeDef;
+extern struct i2cHost_bus i2cHost_bus1;
+extern struct i2cHost_bus i2cHost_bus2;
+#define I2C1 (&i2cHost_bus1)
+#define I2C2 (&i2cHost_bus2)
+
+typedef struct {
+	uint32_t ClockSpeed;
+	uint32_t DutyCycle;
+	uint32_t OwnAddress1;
+	uint32_t AddressingMode;
+	uint32_t DualAddressMode;
+	uint32_t OwnAddress2;
+	uint32_t GeneralCallMode;
+	uint32_t NoStretchMode;
+} I2C_InitTypeDef;
+
+typedef struct {
+	I2C_TypeDef * Instance;
+	I2C_InitTypeDef Init;
+} I2C_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+void HAL_I2C_EV_IRQHandler(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ER_IRQHandler(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+#endif /* __STM32F1xx_HAL_H */
@@ -0,0 +1,209 @@
+/**
+ * @file i2cHost.c
+ * @author Space Concordia Rocket Division
+ * @brief Simulated I2C buses under the firmware i2c.c for the host build.
+ *
+ * Only the bus timing and the device models are here, the job queue is the one of i2c.c. The completion
+ * interrupt is a sysTimerHost interrupt source shared by the buses.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "i2cHost.h"
+#include "stm32f1xx_hal.h"
+#include "sysTimerHost.h"
+
+struct i2cHost_bus {
+	struct i2cHost_device * devices;
+	I2C_HandleTypeDef * hi2c; // set by HAL_I2C_Init()
+	struct i2cHost_device * device; // of the current transfer
+	uint16_t memoryAddress;
+	uint8_t * data;
+	uint16_t size;
+	bool read;
+	uint32_t currentMicros; // bus time of the current transfer
+	uint32_t doneMicros;
+	bool busy;
+	struct i2cHost_stats stats;
+};
+
+struct i2cHost_bus i2cHost_bus1;
+struct i2cHost_bus i2cHost_bus2;
+static struct i2cHost_bus * const buses[] = {&i2cHost_bus1, &i2cHost_bus2};
+static bool sourceAdded = false;
+
+static bool nextCompletion(uint32_t * micros);
+static void completeTransfers(void);
+
+// McuDevice_I2C points to the i2c_Peripheral of i2c.c, its hal handle is first
+static inline struct i2cHost_bus * busOf(McuDevice_I2C bus) {
+	return ((I2C_HandleTypeDef *) bus)->Instance;
+}
+
+static struct i2cHost_device * findDevice(struct i2cHost_bus * bus, uint16_t address) {
+	for (struct i2cHost_device * device = bus->devices; device != NULL; device = device->next) {
+		if (device->address == (address >> 1)) {
+			return device;
+		}
+	}
+	return NULL;
+}
+
+static size_t addressBytes(uint16_t memAddSize) {
+	return (memAddSize == I2C_MEMADD_SIZE_16BIT) ? 2 : 1;
+}
+
+// start, slave address, register address, restart and slave address for a read, data, stop
+static uint32_t busMicros(I2C_HandleTypeDef * hi2c, struct i2cHost_device * device, uint16_t memAddSize,
+		size_t size, bool read) {
+	uint32_t clockSpeed = (hi2c->Init.ClockSpeed > 0) ? hi2c->Init.ClockSpeed : I2CHOST_CLOCKSPEED;
+	uint64_t bits = 1 + 9 * (1 + addressBytes(memAddSize) + size) + 1;
+	if (read) {
+		bits += 1 + 9;
+	}
+	uint32_t micros = (uint32_t) ((bits * 1000000 + clockSpeed - 1) / clockSpeed);
+	return micros + ((device != NULL) ? device->latencyMicros : 0);
+}
+
+/*
+ * Plays the transfer on the model, the address is NACKed if no model answers.
+ */
+static bool transfer(struct i2cHost_device * device, uint16_t memoryAddress, uint8_t * data, size_t size,
+		bool read) {
+	if (device == NULL || !device->start(device, memoryAddress)) {
+		return false;
+	}
+	for (size_t i = 0; i < size; i++) {
+		if (read) {
+			data[i] = device->read(device);
+		} else {
+			device->write(device, data[i]);
+		}
+	}
+	return true;
+}
+
+bool i2cHost_attach(McuDevice_I2C bus, struct i2cHost_device * device) {
+	struct i2cHost_bus * hostBus = busOf(bus);
+	if (findDevice(hostBus, (uint16_t) (device->address << 1)) != NULL) {
+		return false;
+	}
+	device->next = hostBus->devices;
+	hostBus->devices = device;
+	return true;
+}
+
+void i2cHost_getStats(McuDevice_I2C bus, struct i2cHost_stats * stats) {
+	*stats = busOf(bus)->stats;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c) {
+	struct i2cHost_bus * bus = hi2c->Instance;
+
+	bus->hi2c = hi2c;
+	bus->busy = false;
+	memset(&bus->stats, 0, sizeof(bus->stats));
+
+	if (!sourceAdded) {
+		sourceAdded = sysTimerHost_addInterruptSource(nextCompletion, completeTransfers);
+	}
+	return sourceAdded ? HAL_OK : HAL_ERROR;
+}
+
+static HAL_StatusTypeDef startTransfer(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size, bool read) {
+	struct i2cHost_bus * bus = hi2c->Instance;
+	struct i2cHost_device * device = findDevice(bus, DevAddress);
+	if (bus->busy || device == NULL) {
+		bus->stats.refusedCount++;
+		return bus->busy ? HAL_BUSY : HAL_ERROR;
+	}
+
+	bus->device = device;
+	bus->memoryAddress = MemAddress;
+	bus->data = pData;
+	bus->size = Size;
+	bus->read = read;
+	bus->currentMicros = busMicros(hi2c, device, MemAddSize, Size, read);
+	bus->doneMicros = sysTimer_GetMicros() + bus->currentMicros;
+	bus->busy = true;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size) {
+	return startTransfer(hi2c, DevAddress, MemAddress, MemAddSize, pData, Size, false);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size) {
+	return startTransfer(hi2c, DevAddress, MemAddress, MemAddSize, pData, Size, true);
+}
+
+static HAL_StatusTypeDef transferBlocking(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size, bool read) {
+	struct i2cHost_bus * bus = hi2c->Instance;
+	if (bus->busy) {
+		return HAL_BUSY;
+	}
+
+	struct i2cHost_device * device = findDevice(bus, DevAddress);
+	sysTimerHost_advanceMicros(busMicros(hi2c, device, MemAddSize, Size, read));
+	return transfer(device, MemAddress, pData, Size, read) ? HAL_OK : HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+	return transferBlocking(hi2c, DevAddress, MemAddress, MemAddSize, pData, Size, false);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+	return transferBlocking(hi2c, DevAddress, MemAddress, MemAddSize, pData, Size, true);
+}
+
+// the transfers complete from completeTransfers(), the interrupt handlers of i2c.c are never called
+void HAL_I2C_EV_IRQHandler(I2C_HandleTypeDef *hi2c) {
+}
+
+void HAL_I2C_ER_IRQHandler(I2C_HandleTypeDef *hi2c) {
+}
+
+static bool nextCompletion(uint32_t * micros) {
+	bool found = false;
+	for (size_t i = 0; i < sizeof(buses) / sizeof(buses[0]); i++) {
+		struct i2cHost_bus * bus = buses[i];
+		if (bus->busy && (!found || (int32_t) (bus->doneMicros - *micros) < 0)) {
+			*micros = bus->doneMicros;
+			found = true;
+		}
+	}
+	return found;
+}
+
+// completion interrupt of the buses whose transfer is done, the callback may start the next transfer
+static void completeTransfers(void) {
+	uint32_t now = sysTimer_GetMicros();
+	for (size_t i = 0; i < sizeof(buses) / sizeof(buses[0]); i++) {
+		struct i2cHost_bus * bus = buses[i];
+		if (!bus->busy || (int32_t) (bus->doneMicros - now) > 0) {
+			continue;
+		}
+
+		bool done = transfer(bus->device, bus->memoryAddress, bus->data, bus->size, bus->read);
+		bus->stats.jobCount++;
+		bus->stats.byteCount += bus->size;
+		bus->stats.busyMicros += bus->currentMicros;
+		bus->busy = false;
+
+		if (!done) {
+			bus->stats.errorCount++;
+			HAL_I2C_ErrorCallback(bus->hi2c);
+		} else if (bus->read) {
+			HAL_I2C_MemRxCpltCallback(bus->hi2c);
+		} else {
+			HAL_I2C_MemTxCpltCallback(bus->hi2c);
+		}
+	}
+}
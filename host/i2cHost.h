@@ -0,0 +1,58 @@
+/**
+ * @file i2cHost.h
+ * @author Space Concordia Rocket Division
+ * @brief Simulated I2C buses under the firmware i2c.c for the host build.
+ *
+ * i2c.c is built unchanged, its job queue runs on the I2C part of the hal implemented here. The two
+ * buses of mcuDevices.h are simulated, the device models are attached to a bus with their 7 bit
+ * address. A transfer is played byte by byte on the model: start() with the register address, then
+ * read() or write() for each data byte, so the model implements its own auto-increment.
+ *
+ * HAL_I2C_Mem_Read_IT() and HAL_I2C_Mem_Write_IT() complete at the end of their bus time through a
+ * sysTimerHost interrupt source, which calls the completion callbacks of i2c.c. The bus time is
+ * 9 bits per byte at the clock speed of the handle plus the start, restart and stop conditions, plus
+ * the latency of the model. The bytes are exchanged with the model at the end of the transfer. A slave
+ * address without a model is NACKed when the transfer starts. The blocking transfers advance the
+ * virtual clock by their bus time.
+ */
+
+#ifndef I2CHOST_H_
+#define I2CHOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "i2c.h"
+
+#define I2CHOST_CLOCKSPEED 400000
+
+/**
+ * @brief A device model on a simulated bus, the model struct starts with it.
+ */
+struct i2cHost_device {
+	uint8_t address; // 7 bit format
+	uint32_t latencyMicros; // added to each transfer, eg. clock stretching
+	bool (*start)(struct i2cHost_device * device, uint16_t memoryAddress); // false to NACK the transfer
+	uint8_t (*read)(struct i2cHost_device * device);
+	void (*write)(struct i2cHost_device * device, uint8_t value);
+	struct i2cHost_device * next;
+};
+
+struct i2cHost_stats {
+	uint32_t jobCount; // interrupt transfers completed, the blocking transfers are not counted
+	uint32_t errorCount; // completed with HAL_I2C_ErrorCallback()
+	uint32_t refusedCount; // interrupt transfers that didn't start, the bus was busy or the address NACKed
+	uint64_t byteCount;
+	uint64_t busyMicros; // bus time of the completed jobs
+};
+
+/**
+ * @brief Attach a device model to the bus, before i2c_open().
+ *
+ * @return false if the address is already used on the bus.
+ */
+bool i2cHost_attach(McuDevice_I2C bus, struct i2cHost_device * device);
+
+void i2cHost_getStats(McuDevice_I2C bus, struct i2cHost_stats * stats);
+
+#endif /* I2CHOST_H_ */
@@ -0,0 +1,285 @@
+/**
+ * @file lsm303dlhcModel.c
+ * @author Space Concordia Rocket Division
+ * @brief Register level model of the LSM303DLHC accelerometer on a simulated i2c bus.
+ *
+ * The read samples are kept in an elementBuffer for lsm303dlhcModel_popRead(), a sample that doesn't
+ * fit is counted in readLogDroppedCount.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "lsm303dlhcModel.h"
+#include "elementBuffer.h"
+#include "extiHost.h"
+#include "sysTimerHost.h"
+
+#define ADDRESS 0x19
+#define REGISTERS_COUNT 0x40
+#define FIFO_SIZE 32
+#define READ_LOG_SIZE 256
+
+#define CTRL_REG1_A 0x20
+#define CTRL_REG3_A 0x22
+#define CTRL_REG4_A 0x23
+#define CTRL_REG5_A 0x24
+#define STATUS_REG_A 0x27
+#define OUT_X_L_A 0x28
+#define OUT_Z_H_A 0x2D
+#define FIFO_CTRL_REG_A 0x2E
+#define FIFO_SRC_REG_A 0x2F
+
+#define AUTO_INC 0x80
+#define CTRL_REG1_ODR_SHIFT 4
+#define CTRL_REG1_DEFAULT 0x07
+#define CTRL_REG3_I1_DRDY1 0x10
+#define CTRL_REG3_I1_WTM 0x04
+#define CTRL_REG3_I1_OVERRUN 0x02
+#define CTRL_REG4_FS_SHIFT 4
+#define CTRL_REG4_FS_MASK 0x30
+#define CTRL_REG5_FIFO_EN 0x40
+#define STATUS_ZYXDA 0x08
+#define STATUS_ZYXOR 0x80
+#define FIFO_CTRL_FM_SHIFT 6
+#define FIFO_CTRL_FTH_MASK 0x1F
+#define FIFO_SRC_WTM 0x80
+#define FIFO_SRC_OVRN 0x40
+#define FIFO_SRC_EMPTY 0x20
+#define FIFO_SRC_FSS 0x1F
+
+enum fifoMode {
+	FIFO_MODE_BYPASS,
+	FIFO_MODE_FIFO,
+	FIFO_MODE_STREAM,
+	FIFO_MODE_TRIGGER,
+};
+
+// Hz by the ODR bits, 0 is power down
+static const uint32_t dataRates[] = {0, 1, 10, 25, 50, 100, 200, 400, 1620, 1344};
+// mg per LSB of the 12 bit value by the FS bits
+static const double sensitivities[] = {1, 2, 4, 12};
+
+struct lsm303dlhcModel {
+	struct i2cHost_device device;
+	struct sensorSignal * signal;
+	int8_t int1Line;
+	uint8_t registers[REGISTERS_COUNT];
+	uint8_t pointer; // register address of the next byte
+	bool autoIncrement;
+	uint32_t nextSampleMicros;
+	uint32_t periodMicros; // 0 in power down
+	struct lsm303dlhcModel_sample output; // without the FIFO
+	struct lsm303dlhcModel_sample fifo[FIFO_SIZE];
+	size_t fifoFirst;
+	size_t fifoCount;
+	bool int1;
+	struct elementBuffer readLog;
+	uint8_t readLogArray[ELEMENTBUFFER_ARRAY_SIZE(sizeof(struct lsm303dlhcModel_sample), READ_LOG_SIZE)];
+	struct lsm303dlhcModel_stats stats;
+};
+
+static struct lsm303dlhcModel model;
+
+static bool fifoEnabled(void) {
+	return (model.registers[CTRL_REG5_A] & CTRL_REG5_FIFO_EN)
+			&& (model.registers[FIFO_CTRL_REG_A] >> FIFO_CTRL_FM_SHIFT) != FIFO_MODE_BYPASS;
+}
+
+static uint8_t fifoSource(void) {
+	// the count of a full FIFO doesn't fit in FSS, OVRN tells it
+	uint8_t source = (uint8_t) (((model.fifoCount < FIFO_SIZE) ? model.fifoCount : FIFO_SIZE - 1) & FIFO_SRC_FSS);
+	if (model.fifoCount > (model.registers[FIFO_CTRL_REG_A] & FIFO_CTRL_FTH_MASK)) {
+		source |= FIFO_SRC_WTM;
+	}
+	if (model.fifoCount == FIFO_SIZE) {
+		source |= FIFO_SRC_OVRN;
+	}
+	if (model.fifoCount == 0) {
+		source |= FIFO_SRC_EMPTY;
+	}
+	return source;
+}
+
+static void updateInt1(void) {
+	uint8_t enabled = model.registers[CTRL_REG3_A];
+	uint8_t source = fifoSource();
+	bool level = ((enabled & CTRL_REG3_I1_DRDY1) && (model.registers[STATUS_REG_A] & STATUS_ZYXDA))
+			|| (fifoEnabled() && (enabled & CTRL_REG3_I1_WTM) && (source & FIFO_SRC_WTM))
+			|| (fifoEnabled() && (enabled & CTRL_REG3_I1_OVERRUN) && (source & FIFO_SRC_OVRN));
+	if (level && !model.int1) {
+		model.stats.int1EdgeCount++;
+		if (model.int1Line >= 0) {
+			extiHost_raise((uint8_t) model.int1Line);
+		}
+	}
+	model.int1 = level;
+}
+
+static void updateDataRate(void) {
+	uint8_t odr = model.registers[CTRL_REG1_A] >> CTRL_REG1_ODR_SHIFT;
+	uint32_t hz = (odr < sizeof(dataRates) / sizeof(dataRates[0])) ? dataRates[odr] : 0;
+	uint32_t periodMicros = (hz > 0) ? 1000000 / hz : 0;
+	if (periodMicros != model.periodMicros) {
+		model.periodMicros = periodMicros;
+		model.nextSampleMicros = sysTimer_GetMicros() + periodMicros;
+	}
+}
+
+static int16_t toRaw(double mg) {
+	double sensitivity = sensitivities[(model.registers[CTRL_REG4_A] & CTRL_REG4_FS_MASK) >> CTRL_REG4_FS_SHIFT];
+	double raw = round(mg / sensitivity);
+	return (int16_t) ((raw < -2048) ? -2048 : (raw > 2047) ? 2047 : raw);
+}
+
+static bool nextSample(uint32_t * micros) {
+	*micros = model.nextSampleMicros;
+	return model.periodMicros > 0;
+}
+
+// sample clock interrupt
+static void takeSample(void) {
+	double values[3];
+	struct lsm303dlhcModel_sample sample = {.micros = model.nextSampleMicros};
+	sensorSignal_at(model.signal, sample.micros, values);
+	sample.x = toRaw(values[0]);
+	sample.y = toRaw(values[1]);
+	sample.z = toRaw(values[2]);
+	model.nextSampleMicros += model.periodMicros;
+	model.stats.sampleCount++;
+
+	if (!fifoEnabled()) {
+		if (model.registers[STATUS_REG_A] & STATUS_ZYXDA) {
+			model.registers[STATUS_REG_A] |= STATUS_ZYXOR;
+			model.stats.lostCount++;
+		}
+		model.registers[STATUS_REG_A] |= STATUS_ZYXDA;
+		model.output = sample;
+	} else if (model.fifoCount < FIFO_SIZE) {
+		model.fifo[(model.fifoFirst + model.fifoCount++) % FIFO_SIZE] = sample;
+	} else if ((model.registers[FIFO_CTRL_REG_A] >> FIFO_CTRL_FM_SHIFT) == FIFO_MODE_FIFO) {
+		model.stats.lostCount++; // the FIFO mode stops when full
+	} else {
+		model.fifo[model.fifoFirst] = sample;
+		model.fifoFirst = (model.fifoFirst + 1) % FIFO_SIZE;
+		model.stats.lostCount++;
+	}
+	updateInt1();
+}
+
+static const struct lsm303dlhcModel_sample * outputSample(void) {
+	if (!fifoEnabled()) {
+		return &model.output;
+	}
+	// an empty FIFO repeats the last sample removed
+	size_t index = (model.fifoCount > 0) ? model.fifoFirst : (model.fifoFirst + FIFO_SIZE - 1) % FIFO_SIZE;
+	return &model.fifo[index];
+}
+
+static void logRead(const struct lsm303dlhcModel_sample * sample) {
+	uint32_t age = sysTimer_GetMicros() - sample->micros;
+	model.stats.readCount++;
+	model.stats.readAgeTotalMicros += age;
+	if (age > model.stats.readAgeMaxMicros) {
+		model.stats.readAgeMaxMicros = age;
+	}
+	if (elementBuffer_push(&model.readLog, sample, 1) != 1) {
+		model.stats.readLogDroppedCount++;
+	}
+}
+
+// the last byte of a sample was read
+static void sampleRead(void) {
+	if (!fifoEnabled()) {
+		if (model.registers[STATUS_REG_A] & STATUS_ZYXDA) {
+			logRead(&model.output);
+		}
+		model.registers[STATUS_REG_A] &= ~(STATUS_ZYXDA | STATUS_ZYXOR);
+	} else if (model.fifoCount > 0) {
+		logRead(&model.fifo[model.fifoFirst]);
+		model.fifoFirst = (model.fifoFirst + 1) % FIFO_SIZE;
+		model.fifoCount--;
+	}
+}
+
+static void advancePointer(void) {
+	if (!model.autoIncrement) {
+		return;
+	}
+	if (model.pointer == OUT_Z_H_A && fifoEnabled()) {
+		model.pointer = OUT_X_L_A;
+	} else {
+		model.pointer = (uint8_t) ((model.pointer + 1) % REGISTERS_COUNT);
+	}
+}
+
+static bool start(struct i2cHost_device * device, uint16_t memoryAddress) {
+	model.pointer = (uint8_t) (memoryAddress & ~AUTO_INC) % REGISTERS_COUNT;
+	model.autoIncrement = (memoryAddress & AUTO_INC) != 0;
+	return true;
+}
+
+static uint8_t readByte(struct i2cHost_device * device) {
+	uint8_t address = model.pointer;
+	uint8_t value;
+	if (address >= OUT_X_L_A && address <= OUT_Z_H_A) {
+		const struct lsm303dlhcModel_sample * sample = outputSample();
+		int16_t axes[] = {sample->x, sample->y, sample->z};
+		uint16_t leftAligned = (uint16_t) (axes[(address - OUT_X_L_A) / 2] * 16);
+		value = ((address - OUT_X_L_A) % 2) ? (uint8_t) (leftAligned >> 8) : (uint8_t) leftAligned;
+		if (address == OUT_Z_H_A) {
+			sampleRead();
+		}
+	} else if (address == FIFO_SRC_REG_A) {
+		value = fifoSource();
+	} else {
+		value = model.registers[address];
+	}
+
+	advancePointer();
+	updateInt1();
+	return value;
+}
+
+static void writeByte(struct i2cHost_device * device, uint8_t value) {
+	uint8_t address = model.pointer;
+	advancePointer();
+	if (address < CTRL_REG1_A || address == STATUS_REG_A || (address >= OUT_X_L_A && address <= OUT_Z_H_A)
+			|| address == FIFO_SRC_REG_A) {
+		return; // read only or reserved
+	}
+
+	model.registers[address] = value;
+	if (address == CTRL_REG1_A) {
+		updateDataRate();
+	} else if ((address == CTRL_REG5_A || address == FIFO_CTRL_REG_A) && !fifoEnabled()) {
+		// the bypass mode empties the FIFO
+		model.fifoCount = 0;
+	}
+	updateInt1();
+}
+
+bool lsm303dlhcModel_attach(McuDevice_I2C bus, const struct lsm303dlhcModel_config * config) {
+	memset(&model, 0, sizeof(model));
+	model.device.address = ADDRESS;
+	model.device.latencyMicros = config->latencyMicros;
+	model.device.start = start;
+	model.device.read = readByte;
+	model.device.write = writeByte;
+	model.signal = config->signal;
+	model.int1Line = config->int1Line;
+	model.registers[CTRL_REG1_A] = CTRL_REG1_DEFAULT;
+	elementBuffer_attachArray(&model.readLog, model.readLogArray, sizeof(model.readLogArray),
+			sizeof(struct lsm303dlhcModel_sample));
+
+	return sysTimerHost_addInterruptSource(nextSample, takeSample) && i2cHost_attach(bus, &model.device);
+}
+
+bool lsm303dlhcModel_popRead(struct lsm303dlhcModel_sample * sample) {
+	return elementBuffer_pop(&model.readLog, sample, 1) == 1;
+}
+
+void lsm303dlhcModel_getStats(struct lsm303dlhcModel_stats * stats) {
+	*stats = model.stats;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file lsm303dlhcModel.h
+ * @author Space Concordia Rocket Division
+ * @brief Register level model of the LSM303DLHC accelerometer on a simulated i2c bus.
+ *
+ * The accelerometer samples the signal at the ODR of CTRL_REG1_A into the 12 bit left aligned output
+ * registers, at the full scale of CTRL_REG4_A. The magnetometer isn't modeled.
+ * 	-without the FIFO the output registers hold the last sample, STATUS_REG_A gets ZYXDA, or ZYXOR if the
+ * 	previous sample wasn't read. A read of OUT_Z_H_A clears them.
+ * 	-with FIFO_EN in CTRL_REG5_A and a FIFO mode in FIFO_CTRL_REG_A, the samples go in the 32 level FIFO.
+ * 	The output registers are the oldest sample, a read of OUT_Z_H_A removes it. The stream and trigger
+ * 	modes overwrite the oldest sample when full, the FIFO mode stops. FIFO_SRC_REG_A has WTM when there
+ * 	are more samples than FTH, OVRN when full, EMPTY and the count of samples.
+ * 	-INT1 is the OR of the sources enabled in CTRL_REG3_A (I1_DRDY1, I1_WTM, I1_OVERRUN), its rising
+ * 	edges are raised on the exti line of the config.
+ * 	-the register address auto-increments when its MSB is set, from OUT_Z_H_A back to OUT_X_L_A while
+ * 	the FIFO is enabled.
+ * The signal channels are the x, y and z acceleration in mg.
+ */
+
+#ifndef LSM303DLHCMODEL_H_
+#define LSM303DLHCMODEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "i2cHost.h"
+#include "sensorSignal.h"
+
+struct lsm303dlhcModel_config {
+	struct sensorSignal * signal;
+	int8_t int1Line; // exti line of INT1, -1 if not wired
+	uint32_t latencyMicros; // added to each transfer
+};
+
+/**
+ * @brief A sample as read by the driver, the 12 bit value of each axis.
+ */
+struct lsm303dlhcModel_sample {
+	uint32_t micros; // time it was sampled
+	int16_t x;
+	int16_t y;
+	int16_t z;
+};
+
+struct lsm303dlhcModel_stats {
+	uint32_t sampleCount;
+	uint32_t lostCount; // overwritten before they were read, or not stored by a full FIFO
+	uint32_t readCount;
+	uint64_t readAgeTotalMicros; // from the sample time to the read of OUT_Z_H_A
+	uint32_t readAgeMaxMicros;
+	uint32_t int1EdgeCount;
+	uint32_t readLogDroppedCount; // read samples that didn't fit for lsm303dlhcModel_popRead()
+};
+
+/**
+ * @brief Attach the only model of the program to the bus, before i2c_open().
+ */
+bool lsm303dlhcModel_attach(McuDevice_I2C bus, const struct lsm303dlhcModel_config * config);
+
+/**
+ * @brief Pop the oldest sample read from the output registers, up to 256 are kept.
+ *
+ * @return false if there is none.
+ */
+bool lsm303dlhcModel_popRead(struct lsm303dlhcModel_sample * sample);
+
+void lsm303dlhcModel_getStats(struct lsm303dlhcModel_stats * stats);
+
+#endif /* LSM303DLHCMODEL_H_ */
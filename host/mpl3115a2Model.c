@@ -0,0 +1,215 @@
+/**
+ * @file mpl3115a2Model.c
+ * @author Space Concordia Rocket Division
+ * @brief Register level model of the MPL3115A2 barometer on a simulated i2c bus.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "mpl3115a2Model.h"
+#include "extiHost.h"
+#include "sysTimerHost.h"
+
+#define ADDRESS 0x60
+#define WHO_AM_I_VALUE 0xC4
+#define REGISTERS_COUNT 0x2E
+#define RESET_MICROS 1000
+
+#define STATUS 0x00
+#define OUT_P_MSB 0x01
+#define OUT_P_CSB 0x02
+#define OUT_P_LSB 0x03
+#define OUT_T_MSB 0x04
+#define OUT_T_LSB 0x05
+#define DR_STATUS 0x06
+#define WHO_AM_I 0x0C
+#define CTRL_REG1 0x26
+#define CTRL_REG4 0x29
+#define CTRL_REG5 0x2A
+
+#define STATUS_TDR 0x02
+#define STATUS_PDR 0x04
+#define STATUS_PTDR 0x08
+#define STATUS_TOW 0x20
+#define STATUS_POW 0x40
+#define STATUS_PTOW 0x80
+
+#define CTRL_REG1_SBYB 0x01
+#define CTRL_REG1_OST 0x02
+#define CTRL_REG1_RST 0x04
+#define CTRL_REG1_OS_SHIFT 3
+#define CTRL_REG1_OS_MASK 0x38
+#define CTRL_REG4_INT_EN_DRDY 0x80
+#define CTRL_REG5_INT_CFG_DRDY 0x80
+
+// minimum time between data samples of the datasheet, by the OS bits
+static const uint32_t conversionMicros[] = {6000, 10000, 18000, 34000, 66000, 130000, 258000, 512000};
+
+struct mpl3115a2Model {
+	struct i2cHost_device device;
+	struct sensorSignal * signal;
+	int8_t int1Line;
+	uint8_t registers[REGISTERS_COUNT];
+	uint8_t pointer; // register address of the next byte
+	bool converting;
+	uint32_t conversionEnd;
+	uint32_t resetEnd;
+	bool resetting;
+	bool int1;
+	uint32_t outEndMicros; // end of the conversion in OUT_P and OUT_T
+	struct mpl3115a2Model_stats stats;
+};
+
+static struct mpl3115a2Model model;
+
+static void reset(void) {
+	memset(model.registers, 0, sizeof(model.registers));
+	model.registers[WHO_AM_I] = WHO_AM_I_VALUE;
+	model.converting = false;
+	model.int1 = false;
+}
+
+static uint8_t * status(void) {
+	return &model.registers[DR_STATUS];
+}
+
+// INT1 follows PTDR when the data ready interrupt is enabled and routed to it
+static void updateInt1(void) {
+	bool level = (model.registers[CTRL_REG4] & CTRL_REG4_INT_EN_DRDY)
+			&& (model.registers[CTRL_REG5] & CTRL_REG5_INT_CFG_DRDY) && (*status() & STATUS_PTDR);
+	if (level && !model.int1 && model.int1Line >= 0) {
+		extiHost_raise((uint8_t) model.int1Line);
+	}
+	model.int1 = level;
+}
+
+static bool nextConversionEnd(uint32_t * micros) {
+	*micros = model.conversionEnd;
+	return model.converting;
+}
+
+// end of conversion interrupt
+static void endConversion(void) {
+	double values[2];
+	sensorSignal_at(model.signal, model.conversionEnd, values);
+
+	// Q18.2 Pa in the 20 bits of OUT_P, Q8.4 degrees in the 12 bits of OUT_T
+	double pressure = round(values[0] * 4);
+	uint32_t rawPressure = (pressure < 0) ? 0 : (pressure > 0xFFFFF) ? 0xFFFFF : (uint32_t) pressure;
+	double temperature = round(values[1] * 16);
+	int32_t rawTemperature = (temperature < -2048) ? -2048 : (temperature > 2047) ? 2047 : (int32_t) temperature;
+
+	model.registers[OUT_P_MSB] = (uint8_t) (rawPressure >> 12);
+	model.registers[OUT_P_CSB] = (uint8_t) (rawPressure >> 4);
+	model.registers[OUT_P_LSB] = (uint8_t) (rawPressure << 4);
+	model.registers[OUT_T_MSB] = (uint8_t) (rawTemperature >> 4);
+	model.registers[OUT_T_LSB] = (uint8_t) (rawTemperature << 4);
+
+	uint8_t * drStatus = status();
+	if (*drStatus & STATUS_PDR) {
+		*drStatus |= STATUS_POW | STATUS_PTOW;
+		model.stats.overwrittenCount++;
+	}
+	if (*drStatus & STATUS_TDR) {
+		*drStatus |= STATUS_TOW | STATUS_PTOW;
+	}
+	*drStatus |= STATUS_PDR | STATUS_TDR | STATUS_PTDR;
+
+	model.outEndMicros = model.conversionEnd;
+	model.converting = false;
+	model.registers[CTRL_REG1] &= ~CTRL_REG1_OST;
+	model.stats.conversionCount++;
+	updateInt1();
+}
+
+static void writeCtrlReg1(uint8_t value) {
+	if (value & CTRL_REG1_RST) {
+		reset();
+		model.resetting = true;
+		model.resetEnd = sysTimer_GetMicros() + RESET_MICROS;
+		return;
+	}
+
+	model.registers[CTRL_REG1] = value;
+	if ((value & CTRL_REG1_OST) && !(value & CTRL_REG1_SBYB) && !model.converting) {
+		model.converting = true;
+		model.conversionEnd = sysTimer_GetMicros()
+				+ conversionMicros[(value & CTRL_REG1_OS_MASK) >> CTRL_REG1_OS_SHIFT];
+	}
+}
+
+static bool start(struct i2cHost_device * device, uint16_t memoryAddress) {
+	if (model.resetting && (int32_t) (sysTimer_GetMicros() - model.resetEnd) < 0) {
+		return false;
+	}
+	model.resetting = false;
+	model.pointer = (uint8_t) memoryAddress;
+	return true;
+}
+
+static uint8_t readByte(struct i2cHost_device * device) {
+	uint8_t address = model.pointer;
+	model.pointer = (uint8_t) ((model.pointer + 1) % REGISTERS_COUNT);
+	if (address >= REGISTERS_COUNT) {
+		return 0;
+	}
+
+	// STATUS is a copy of DR_STATUS without the FIFO
+	uint8_t value = model.registers[(address == STATUS) ? DR_STATUS : address];
+	uint8_t * drStatus = status();
+	if (address == OUT_P_MSB && (*drStatus & STATUS_PDR)) {
+		uint32_t now = sysTimer_GetMicros();
+		uint32_t age = now - model.outEndMicros;
+		model.stats.readCount++;
+		model.stats.readAgeTotalMicros += age;
+		if (age > model.stats.readAgeMaxMicros) {
+			model.stats.readAgeMaxMicros = age;
+		}
+		model.stats.lastReadEndMicros = model.outEndMicros;
+		model.stats.lastReadPressure = ((uint32_t) model.registers[OUT_P_MSB] << 12)
+				| ((uint32_t) model.registers[OUT_P_CSB] << 4) | (model.registers[OUT_P_LSB] >> 4);
+		*drStatus &= ~(STATUS_PDR | STATUS_POW);
+	} else if (address == OUT_T_MSB) {
+		*drStatus &= ~(STATUS_TDR | STATUS_TOW);
+	}
+	if (!(*drStatus & (STATUS_PDR | STATUS_TDR))) {
+		*drStatus &= ~(STATUS_PTDR | STATUS_PTOW);
+	}
+	updateInt1();
+	return value;
+}
+
+static void writeByte(struct i2cHost_device * device, uint8_t value) {
+	uint8_t address = model.pointer;
+	model.pointer = (uint8_t) ((model.pointer + 1) % REGISTERS_COUNT);
+	if (address >= REGISTERS_COUNT || address <= DR_STATUS || address == WHO_AM_I) {
+		return; // read only
+	}
+
+	if (address == CTRL_REG1) {
+		writeCtrlReg1(value);
+	} else {
+		model.registers[address] = value;
+	}
+	updateInt1();
+}
+
+bool mpl3115a2Model_attach(McuDevice_I2C bus, const struct mpl3115a2Model_config * config) {
+	memset(&model, 0, sizeof(model));
+	model.device.address = ADDRESS;
+	model.device.latencyMicros = config->latencyMicros;
+	model.device.start = start;
+	model.device.read = readByte;
+	model.device.write = writeByte;
+	model.signal = config->signal;
+	model.int1Line = config->int1Line;
+	reset();
+
+	return sysTimerHost_addInterruptSource(nextConversionEnd, endConversion) && i2cHost_attach(bus, &model.device);
+}
+
+void mpl3115a2Model_getStats(struct mpl3115a2Model_stats * stats) {
+	*stats = model.stats;
+}
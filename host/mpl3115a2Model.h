@@ -0,0 +1,50 @@
+/**
+ * @file mpl3115a2Model.h
+ * @author Space Concordia Rocket Division
+ * @brief Register level model of the MPL3115A2 barometer on a simulated i2c bus.
+ *
+ * The model implements the one shot mode used by the driver, the active mode isn't modeled:
+ * 	-a write of CTRL_REG1 with OST in standby starts a conversion of the oversampling time of the
+ * 	datasheet, at its end the signal is latched in OUT_P and OUT_T, OST clears and STATUS gets PDR,
+ * 	TDR and PTDR, or the overwrite bits if the previous sample wasn't read.
+ * 	-a read of OUT_P_MSB clears PDR, a read of OUT_T_MSB clears TDR.
+ * 	-with INT_EN_DRDY in CTRL_REG4 and INT_CFG_DRDY in CTRL_REG5, INT1 follows PTDR and its rising edges
+ * 	are raised on the exti line of the config.
+ * 	-a write of CTRL_REG1 with RST resets the registers, the device NACKs for 1 ms.
+ * 	-the register address auto-increments after each byte.
+ * The signal channels are the pressure in Pa and the temperature in degrees C.
+ */
+
+#ifndef MPL3115A2MODEL_H_
+#define MPL3115A2MODEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "i2cHost.h"
+#include "sensorSignal.h"
+
+struct mpl3115a2Model_config {
+	struct sensorSignal * signal;
+	int8_t int1Line; // exti line of INT1, -1 if not wired
+	uint32_t latencyMicros; // added to each transfer
+};
+
+struct mpl3115a2Model_stats {
+	uint32_t conversionCount;
+	uint32_t overwrittenCount; // conversions overwritten before their pressure was read
+	uint32_t readCount; // conversions whose pressure was read
+	uint64_t readAgeTotalMicros; // from the end of the conversion to the read of OUT_P_MSB
+	uint32_t readAgeMaxMicros;
+	uint32_t lastReadEndMicros; // end of the conversion of the last pressure read
+	uint32_t lastReadPressure; // Q18.2 Pa of the last pressure read
+};
+
+/**
+ * @brief Attach the only model of the program to the bus, before i2c_open().
+ */
+bool mpl3115a2Model_attach(McuDevice_I2C bus, const struct mpl3115a2Model_config * config);
+
+void mpl3115a2Model_getStats(struct mpl3115a2Model_stats * stats);
+
+#endif /* MPL3115A2MODEL_H_ */
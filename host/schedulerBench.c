@@ -0,0 +1,67 @@
+/**
+ * @file schedulerBench.c
+ * @author Space Concordia Rocket Division
+ * @brief Host benchmark of the scheduler dispatch cost as the number of tasks grows.
+ * 
+ * For each task count, repeating tasks with pseudo-random intervals are created and the scheduler
+ * runs until DISPATCH_COUNT tasks were called. The virtual clock advances 1 ms every 2 calls to
+ * sysTimer_GetTick(), which is about once per pass of runScheduler(), so the wait queue stays full
+ * and every dispatch goes through a wait queue insertion and removal. The passes column is the
+ * virtual time elapsed, it includes the time skipped while the scheduler was idle.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+#include "sysTimerHost.h"
+
+#define DISPATCH_COUNT 1000000
+#define MAX_INTERVAL_MS 50
+
+static uint32_t dispatchCount = 0;
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom(void) {
+	randomState = randomState * 1103515245u + 12345u;
+	return (randomState >> 16) & 0x7FFF;
+}
+
+static void benchTask(uint32_t event, void * arg) {
+	dispatchCount++;
+	if (dispatchCount >= DISPATCH_COUNT) {
+		scheduler_exit();
+	}
+}
+
+int main(void) {
+	struct task * tasks[TASKS_MAX_COUNT];
+	
+	printf("%6s %12s %12s %14s\n", "tasks", "dispatches", "passes", "ns/dispatch");
+	for (int taskCount = 1; taskCount <= TASKS_MAX_COUNT; taskCount++) {
+		sysTimerHost_setTick(0);
+		sysTimerHost_setAutoAdvance(2);
+		randomState = 1;
+		dispatchCount = 0;
+		
+		for (int i = 0; i < taskCount; i++) {
+			uint32_t interval = 1 + nextRandom() % MAX_INTERVAL_MS;
+			tasks[i] = createTask(benchTask, 0, NULL, interval, true, i % TASKS_PRIORITY_COUNT);
+		}
+		
+		uint64_t start = sysTimerHost_nanos();
+		runScheduler();
+		uint64_t elapsed = sysTimerHost_nanos() - start;
+		uint32_t passes = sysTimer_GetTick();
+		
+		for (int i = 0; i < taskCount; i++) {
+			destroyTask(tasks[i]);
+		}
+		
+		printf("%6d %12" PRIu32 " %12" PRIu32 " %14.1f\n", taskCount, dispatchCount, passes,
+				(double) elapsed / dispatchCount);
+	}
+	
+	return 0;
+}
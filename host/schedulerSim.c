@@ -0,0 +1,225 @@
+/**
+ * @file schedulerSim.c
+ * @author Space Concordia Rocket Division
+ * @brief Virtual time simulation of synthetic task sets on the scheduler.
+ *
+ * Every task of a set is a repeated task in SCHEDULER_PERIOD_DEADLINE_SKIP mode, like the drivers. The
+ * task body advances the virtual clock by its run time, so the scheduler sees the same timing as on the
+ * board without any real work. The simulator keeps its own ideal release time for each task,
+ * a release every period from the start, to measure the scheduler against it:
+ * 	-latency is the virtual time between the release and the start of the run, in ms.
+ * 	-a deadline miss is a run that ends after the next release, or a release that was skipped.
+ * The dispatch overhead is the host time spent in runScheduler() outside of the task bodies, divided
+ * by the number of runs.
+ *
+ * Usage: schedulerSim [set name]
+ * 	Without argument all the sets are simulated. The exit status is 1 if a set expected to be
+ * 	schedulable missed a deadline, so it can be used as a regression test.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "scheduler.h"
+#include "sysTimerHost.h"
+
+#define SIM_DURATION_MS 60000
+#define SIM_MAX_TASKS 16
+#define LATENCY_BUCKETS 8
+
+struct simTaskSpec {
+	uint32_t period;
+	uint32_t runTimeMin; // ms of virtual time per run, picked uniformly between min and max
+	uint32_t runTimeMax;
+	uint8_t priority;
+};
+
+struct simTaskSet {
+	const char * name;
+	bool schedulable; // no deadline miss expected
+	size_t count;
+	struct simTaskSpec tasks[SIM_MAX_TASKS];
+};
+
+struct simTask {
+	const struct simTaskSpec * spec;
+	struct task * task;
+	uint32_t nextRelease;
+	uint32_t runCount;
+	uint32_t missCount;
+	uint32_t latencyMax;
+	uint32_t latencyHistogram[LATENCY_BUCKETS];
+};
+
+static const struct simTaskSet taskSets[] = {
+	{"flight", true, 6, { // the periods of the application tasks
+		{10, 1, 1, 2}, // accelerometer
+		{20, 0, 1, 4}, // pitot
+		{20, 0, 0, 5}, // commands
+		{50, 2, 3, 1}, // telemetry
+		{100, 1, 2, 3}, // barometer
+		{500, 0, 0, 7}, // blink
+	}},
+	{"harmonic", true, 4, {
+		{5, 1, 1, 0},
+		{10, 2, 2, 1},
+		{20, 3, 3, 2},
+		{40, 4, 4, 3},
+	}},
+	{"inverted", false, 3, { // the short period has the lowest priority
+		{5, 1, 1, 2},
+		{20, 4, 6, 0},
+		{50, 8, 10, 1},
+	}},
+	{"overload", false, 4, {
+		{10, 3, 5, 0},
+		{20, 5, 8, 1},
+		{25, 4, 6, 2},
+		{100, 10, 20, 3},
+	}},
+};
+
+// upper bound of each bucket in ms, the last one takes everything above
+static const uint32_t latencyBounds[LATENCY_BUCKETS] = {0, 1, 2, 4, 8, 16, 32, UINT32_MAX};
+
+static struct simTask simTasks[SIM_MAX_TASKS];
+static struct task * stopTask;
+static uint32_t simEnd;
+static uint64_t taskNanos;
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom(void) {
+	randomState = randomState * 1103515245u + 12345u;
+	return (randomState >> 16) & 0x7FFF;
+}
+
+static void recordLatency(struct simTask * sim, uint32_t latency) {
+	size_t bucket = 0;
+	while (latency > latencyBounds[bucket]) {
+		bucket++;
+	}
+	sim->latencyHistogram[bucket]++;
+	if (latency > sim->latencyMax) {
+		sim->latencyMax = latency;
+	}
+}
+
+static void simTaskRun(uint32_t event, void * arg) {
+	uint64_t start = sysTimerHost_nanos();
+	struct simTask * sim = arg;
+	const struct simTaskSpec * spec = sim->spec;
+	uint32_t now = sysTimer_GetTick();
+
+	// the run serves the latest release, the releases before it were skipped
+	uint32_t latency = now - sim->nextRelease;
+	uint32_t skipped = latency / spec->period;
+	uint32_t release = sim->nextRelease + skipped * spec->period;
+	sim->missCount += skipped;
+	recordLatency(sim, latency);
+
+	uint32_t runTime = spec->runTimeMin;
+	if (spec->runTimeMax > spec->runTimeMin) {
+		runTime += nextRandom() % (spec->runTimeMax - spec->runTimeMin + 1);
+	}
+	sysTimerHost_advance(runTime);
+
+	sim->nextRelease = release + spec->period;
+	if ((int32_t) (sysTimer_GetTick() - sim->nextRelease) > 0) {
+		sim->missCount++;
+	}
+	sim->runCount++;
+	taskNanos += sysTimerHost_nanos() - start;
+}
+
+// runs once when created and once at the end of the simulation
+static void simStop(uint32_t event, void * arg) {
+	if ((int32_t) (sysTimer_GetTick() - simEnd) < 0) {
+		return;
+	}
+	scheduler_exit();
+}
+
+static bool simulate(const struct simTaskSet * set) {
+	uint32_t utilization = 0; // in 1/1000
+
+	memset(simTasks, 0, sizeof(simTasks));
+	sysTimerHost_setAutoAdvance(0);
+	sysTimerHost_setTick(0);
+	randomState = 1;
+	taskNanos = 0;
+	simEnd = SIM_DURATION_MS;
+
+	stopTask = createTask(simStop, 0, NULL, SIM_DURATION_MS, true, 0);
+	scheduler_setPeriodMode(stopTask, SCHEDULER_PERIOD_DEADLINE_SKIP);
+	for (size_t i = 0; i < set->count; i++) {
+		struct simTask * sim = &simTasks[i];
+		sim->spec = &set->tasks[i];
+		sim->task = createTask(simTaskRun, 0, sim, sim->spec->period, true, sim->spec->priority);
+		scheduler_setPeriodMode(sim->task, SCHEDULER_PERIOD_DEADLINE_SKIP);
+		utilization += (sim->spec->runTimeMin + sim->spec->runTimeMax) * 500 / sim->spec->period;
+	}
+	scheduler_resetIdleStats();
+
+	uint64_t start = sysTimerHost_nanos();
+	runScheduler();
+	uint64_t schedulerNanos = sysTimerHost_nanos() - start - taskNanos;
+
+	struct scheduler_idleStats idle;
+	scheduler_getIdleStats(&idle);
+
+	printf("%s: %zu tasks, utilization %" PRIu32 ".%01" PRIu32 "%%, %u ms\n", set->name, set->count,
+			utilization / 10, utilization % 10, SIM_DURATION_MS);
+	printf("%4s %6s %7s %6s %6s %6s %6s |", "prio", "period", "run", "runs", "misses", "ovrun", "latMax");
+	for (size_t bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++) {
+		printf(" <=%-4" PRIu32, latencyBounds[bucket]);
+	}
+	printf("  >%-4" PRIu32 "\n", latencyBounds[LATENCY_BUCKETS - 2]);
+
+	uint32_t runs = 0;
+	uint32_t misses = 0;
+	for (size_t i = 0; i < set->count; i++) {
+		struct simTask * sim = &simTasks[i];
+		char runTime[16];
+		snprintf(runTime, sizeof(runTime), "%" PRIu32 "-%" PRIu32, sim->spec->runTimeMin, sim->spec->runTimeMax);
+		printf("%4u %6" PRIu32 " %7s %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " |", sim->spec->priority,
+				sim->spec->period, runTime, sim->runCount, sim->missCount, scheduler_getOverrunCount(sim->task),
+				sim->latencyMax);
+		for (size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+			printf(" %6" PRIu32, sim->latencyHistogram[bucket]);
+		}
+		printf("\n");
+		runs += sim->runCount;
+		misses += sim->missCount;
+		destroyTask(sim->task);
+	}
+	destroyTask(stopTask);
+
+	printf("misses %" PRIu32 ", idle %" PRIu64 " ms in %" PRIu32 " sleeps, dispatch %.1f ns\n\n", misses,
+			idle.idleMicros / 1000, idle.sleepCount, (runs > 0) ? (double) schedulerNanos / runs : 0.0);
+
+	return !set->schedulable || misses == 0;
+}
+
+int main(int argc, char ** argv) {
+	bool passed = true;
+	bool found = false;
+
+	for (size_t i = 0; i < sizeof(taskSets) / sizeof(taskSets[0]); i++) {
+		if (argc > 1 && strcmp(argv[1], taskSets[i].name) != 0) {
+			continue;
+		}
+		found = true;
+		if (!simulate(&taskSets[i])) {
+			printf("FAILED: %s missed deadlines\n\n", taskSets[i].name);
+			passed = false;
+		}
+	}
+
+	if (!found) {
+		fprintf(stderr, "unknown task set %s\n", argv[1]);
+		return 2;
+	}
+	return passed ? 0 : 1;
+}
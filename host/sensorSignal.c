@@ -0,0 +1,149 @@
+/**
+ * @file sensorSignal.c
+ * @author Space Concordia Rocket Division
+ * @brief Physical values seen by a simulated sensor, constant or replayed from a trace, with noise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "sensorSignal.h"
+
+#define LINE_MAX_SIZE 256
+
+static uint32_t nextRandom(struct sensorSignal * signal) {
+	signal->randomState = signal->randomState * 1103515245u + 12345u;
+	return (signal->randomState >> 16) & 0x7FFF;
+}
+
+// Box-Muller, one of the pair is used
+static double gaussian(struct sensorSignal * signal) {
+	double u1 = (nextRandom(signal) + 1.0) / 32769.0;
+	double u2 = nextRandom(signal) / 32768.0;
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+void sensorSignal_init(struct sensorSignal * signal, size_t channels, const double * constant, uint32_t seed) {
+	memset(signal, 0, sizeof(*signal));
+	signal->channels = (channels < SENSORSIGNAL_CHANNELS_MAX) ? channels : SENSORSIGNAL_CHANNELS_MAX;
+	memcpy(signal->constant, constant, signal->channels * sizeof(double));
+	signal->randomState = seed;
+}
+
+void sensorSignal_setNoise(struct sensorSignal * signal, const double * noise) {
+	memcpy(signal->noise, noise, signal->channels * sizeof(double));
+}
+
+bool sensorSignal_setTrace(struct sensorSignal * signal, const struct sensorSignal_point * points, size_t count) {
+	for (size_t i = 1; i < count; i++) {
+		if (points[i].ms < points[i - 1].ms) {
+			return false;
+		}
+	}
+
+	struct sensorSignal_point * copy = malloc(count * sizeof(*copy));
+	if (copy == NULL && count > 0) {
+		return false;
+	}
+	memcpy(copy, points, count * sizeof(*copy));
+	free(signal->points);
+	signal->points = copy;
+	signal->pointsCount = count;
+	signal->cursor = 0;
+	return true;
+}
+
+bool sensorSignal_loadTrace(struct sensorSignal * signal, const char * path) {
+	FILE * file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+
+	struct sensorSignal_point * points = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	bool valid = true;
+	char line[LINE_MAX_SIZE];
+	while (valid && fgets(line, sizeof(line), file) != NULL) {
+		char * cursor = line;
+		while (isspace((unsigned char) *cursor)) {
+			cursor++;
+		}
+		if (!isdigit((unsigned char) *cursor)) {
+			continue;
+		}
+
+		if (count == capacity) {
+			capacity = (capacity > 0) ? capacity * 2 : 64;
+			struct sensorSignal_point * grown = realloc(points, capacity * sizeof(*points));
+			if (grown == NULL) {
+				valid = false;
+				break;
+			}
+			points = grown;
+		}
+
+		struct sensorSignal_point * point = &points[count];
+		point->ms = (uint32_t) strtoul(cursor, &cursor, 10);
+		for (size_t channel = 0; channel < signal->channels && valid; channel++) {
+			char * end;
+			while (*cursor == ',' || isspace((unsigned char) *cursor)) {
+				cursor++;
+			}
+			point->values[channel] = strtod(cursor, &end);
+			valid = (end != cursor);
+			cursor = end;
+		}
+		count++;
+	}
+	fclose(file);
+
+	valid = valid && count > 0 && sensorSignal_setTrace(signal, points, count);
+	free(points);
+	return valid;
+}
+
+void sensorSignal_at(struct sensorSignal * signal, uint32_t micros, double * values) {
+	if (signal->pointsCount == 0) {
+		memcpy(values, signal->constant, signal->channels * sizeof(double));
+	} else {
+		// first point after the time, the replay mostly moves forward from the previous one
+		const struct sensorSignal_point * points = signal->points;
+		size_t next = signal->cursor;
+		while (next > 0 && (uint64_t) points[next - 1].ms * 1000 > micros) {
+			next--;
+		}
+		while (next < signal->pointsCount && (uint64_t) points[next].ms * 1000 <= micros) {
+			next++;
+		}
+		signal->cursor = next;
+
+		if (next == 0 || next == signal->pointsCount) {
+			const struct sensorSignal_point * hold = &points[(next == 0) ? 0 : next - 1];
+			memcpy(values, hold->values, signal->channels * sizeof(double));
+		} else {
+			const struct sensorSignal_point * before = &points[next - 1];
+			const struct sensorSignal_point * after = &points[next];
+			double ratio = (micros - (uint64_t) before->ms * 1000) / ((after->ms - before->ms) * 1000.0);
+			for (size_t channel = 0; channel < signal->channels; channel++) {
+				values[channel] = before->values[channel] + ratio * (after->values[channel] - before->values[channel]);
+			}
+		}
+	}
+
+	for (size_t channel = 0; channel < signal->channels; channel++) {
+		if (signal->noise[channel] > 0) {
+			values[channel] += signal->noise[channel] * gaussian(signal);
+		}
+	}
+}
+
+void sensorSignal_free(struct sensorSignal * signal) {
+	free(signal->points);
+	signal->points = NULL;
+	signal->pointsCount = 0;
+	signal->cursor = 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file sensorSignal.h
+ * @author Space Concordia Rocket Division
+ * @brief Physical values seen by a simulated sensor, constant or replayed from a trace, with noise.
+ *
+ * A trace is a list of points in time order, each with a value per channel. The value between two
+ * points is interpolated linearly, before the first and after the last point it holds. Gaussian noise
+ * of the given standard deviation is added to each value read.
+ *
+ * The trace file is a CSV text file, one point per line: the time in ms then the value of each channel.
+ * The lines that don't start with a number, eg. a header or a '#' comment, are skipped:
+ * 		# time_ms,pressure_pa,temperature_c
+ * 		0,101325,20.0
+ * 		5000,101325,20.0
+ * 		15000,89875,13.5
+ */
+
+#ifndef SENSORSIGNAL_H_
+#define SENSORSIGNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SENSORSIGNAL_CHANNELS_MAX 3
+
+struct sensorSignal_point {
+	uint32_t ms;
+	double values[SENSORSIGNAL_CHANNELS_MAX];
+};
+
+struct sensorSignal {
+	size_t channels;
+	double constant[SENSORSIGNAL_CHANNELS_MAX]; // without a trace
+	double noise[SENSORSIGNAL_CHANNELS_MAX]; // standard deviation
+	struct sensorSignal_point * points;
+	size_t pointsCount;
+	size_t cursor; // first point after the last time read
+	uint32_t randomState;
+};
+
+/**
+ * @brief A constant signal without noise, seed selects the noise sequence.
+ */
+void sensorSignal_init(struct sensorSignal * signal, size_t channels, const double * constant, uint32_t seed);
+
+void sensorSignal_setNoise(struct sensorSignal * signal, const double * noise);
+
+/**
+ * @brief Replay a copy of count points instead of the constant.
+ *
+ * @return false if the points aren't in time order or the copy can't be allocated.
+ */
+bool sensorSignal_setTrace(struct sensorSignal * signal, const struct sensorSignal_point * points, size_t count);
+
+/**
+ * @brief Replay the trace file at path instead of the constant.
+ *
+ * @return false if the file can't be read, a line has less values than the channels or the points
+ * 		aren't in time order.
+ */
+bool sensorSignal_loadTrace(struct sensorSignal * signal, const char * path);
+
+/**
+ * @brief Values of the channels at the sysTimer_GetMicros() time, with the noise.
+ */
+void sensorSignal_at(struct sensorSignal * signal, uint32_t micros, double * values);
+
+void sensorSignal_free(struct sensorSignal * signal);
+
+#endif /* SENSORSIGNAL_H_ */
@@ -0,0 +1,377 @@
+/**
+ * @file sensorSim.c
+ * @author Space Concordia Rocket Division
+ * @brief Runs the MPL3115A2 and LSM303DLHC drivers on the simulated i2c buses against the device models.
+ *
+ * The drivers, i2c.c, the scheduler, the acquisition buffers and the logging are the firmware sources,
+ * only the I2C hal, exti and sysTimer are the host implementations. The drivers are opened like in main.c,
+ * the accelerometer on bus 1 and the barometer on bus 2 with their INT1 on the lines of pinmapping.h,
+ * while the flight task set of schedulerSim keeps the main loop busy.
+ *
+ * Without trace files the models see a synthetic flight: on the pad, a boost, a coast to about 3000 m
+ * and a parachute opening. A trace file replaces it, see sensorSignal.h for the format, the barometer
+ * trace has the pressure in Pa and the temperature in degrees C, the accelerometer trace has x, y and z
+ * in mg.
+ *
+ * Each sample given by the drivers is checked against the model:
+ * 	-the accelerometer samples of lsm303dlhc_readSamples() must be the samples read from the FIFO, in
+ * 	order with their values, and their timestamp within one ODR period of the sample time. The
+ * 	acquisition buffer must have the newest of them, with its timestamp.
+ * 	-the barometer value of the acquisition buffer must be the last pressure read, with the end of its
+ * 	conversion as the timestamp, or a time within the poll interval after it when polling.
+ * The age is the virtual time from the sample to its read on the bus. The host time is the real time
+ * taken by the run, to compare the cost of driver changes.
+ *
+ * Usage: sensorSim [-t seconds] [-l latency us] [-n noise scale] [-p pressure trace] [-a accel trace] [-i] [-v]
+ * 	-l adds a latency to every transfer of both devices, eg. clock stretching, -i fails the exti_open() of
+ * 	the drivers so they run on their polling fallback, -v prints the driver warnings. The exit status is 1 if a sample is lost or doesn't match the model.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+#include "sysTimerHost.h"
+#include "extiHost.h"
+#include "i2cHost.h"
+#include "sensorSignal.h"
+#include "mpl3115a2Model.h"
+#include "lsm303dlhcModel.h"
+#include "MPL3115A2.h"
+#include "LSM303DLHC.h"
+#include "acquisitionBuffers.h"
+#include "logging.h"
+#include "pinmapping.h"
+
+#define CHECK_ACCEL_INTERVAL_MS 10
+#define CHECK_BAROMETER_INTERVAL_MS 5
+#define TASK_PRIORITY_CHECK 6
+#define ACCEL_PERIOD_MICROS 2500 // 400 Hz of the driver
+
+struct simLoad {
+	uint32_t period;
+	uint32_t runTimeMin;
+	uint32_t runTimeMax;
+	uint8_t priority;
+};
+
+// the flight set of schedulerSim without the sensors
+static const struct simLoad loads[] = {
+	{20, 0, 1, 4}, // pitot
+	{20, 0, 0, 5}, // commands
+	{50, 2, 3, 1}, // telemetry
+	{500, 0, 0, 7}, // blink
+};
+
+static const struct sensorSignal_point flightPressure[] = {
+	{0, {101325, 20.0}},
+	{5000, {101325, 20.0}}, // ignition
+	{20000, {89875, 12.5}},
+	{40000, {70109, 0.5}}, // apogee
+	{60000, {79495, 6.5}},
+};
+
+static const struct sensorSignal_point flightAccel[] = {
+	{0, {0, 0, 1000}},
+	{5000, {0, 0, 1000}},
+	{5100, {50, -30, 9000}}, // boost
+	{8000, {50, -30, 9000}},
+	{8100, {0, 0, -400}}, // coast
+	{40000, {0, 0, -100}},
+	{40100, {200, 150, 3000}}, // parachute
+	{40500, {0, 0, 1000}},
+};
+
+struct accelCheck {
+	uint32_t count;
+	uint32_t valueErrors;
+	uint32_t timestampErrors;
+	uint32_t missing; // given by the driver but never read from the model
+	uint32_t timestampErrorMax;
+};
+
+struct barometerCheck {
+	uint32_t count;
+	uint32_t valueErrors;
+	uint32_t timestampErrors;
+};
+
+static struct accelCheck accelCheck;
+static struct barometerCheck barometerCheck;
+static uint32_t simEnd;
+static bool polling = false; // the exti lines don't open
+static uint32_t randomState = 1;
+
+// ui2ascii() of main.c, the firmware main can't be linked on the host
+size_t ui2ascii(uint32_t n, uint8_t* buffer) {
+	uint8_t reverse_digits[10];
+	size_t  i = 0;
+	do {
+		reverse_digits[i] = '0' + n % 10;
+		n /= 10;
+		++i;
+	} while (n);
+
+	for (size_t j = 0; j < i; ++j) {
+		buffer[j] = reverse_digits[i - j - 1];
+	}
+
+	return i;
+}
+
+static int writeStdout(uint8_t * data, size_t size) {
+	return (int) fwrite(data, 1, size, stdout);
+}
+
+static uint32_t nextRandom(void) {
+	randomState = randomState * 1103515245u + 12345u;
+	return (randomState >> 16) & 0x7FFF;
+}
+
+static void loadRun(uint32_t event, void * arg) {
+	const struct simLoad * load = arg;
+	uint32_t runTime = load->runTimeMin;
+	if (load->runTimeMax > load->runTimeMin) {
+		runTime += nextRandom() % (load->runTimeMax - load->runTimeMin + 1);
+	}
+	sysTimerHost_advance(runTime);
+}
+
+static void checkAccel(uint32_t event, void * arg) {
+	struct lsm303dlhc_sample samples[32];
+	struct lsm303dlhc_sample newest;
+	size_t count;
+	bool read = false;
+	while ((count = lsm303dlhc_readSamples(samples, 32)) > 0) {
+		newest = samples[count - 1];
+		read = true;
+		for (size_t i = 0; i < count; i++) {
+			struct lsm303dlhcModel_sample expected;
+			if (!lsm303dlhcModel_popRead(&expected)) {
+				accelCheck.missing++;
+				continue;
+			}
+			accelCheck.count++;
+			if (samples[i].x != expected.x || samples[i].y != expected.y || samples[i].z != expected.z) {
+				accelCheck.valueErrors++;
+			}
+			int32_t error = (int32_t) (samples[i].timestamp - expected.micros);
+			uint32_t absError = (uint32_t) ((error < 0) ? -error : error);
+			if (absError > accelCheck.timestampErrorMax) {
+				accelCheck.timestampErrorMax = absError;
+			}
+			if (absError > ACCEL_PERIOD_MICROS) {
+				accelCheck.timestampErrors++;
+			}
+		}
+	}
+	
+	// the acquisition buffer has the newest sample of the last drain, with its time
+	if (read && acqBuff_isNew(acqbuff_Accelerometer)) {
+		uint8_t value[ACQBUFF_ACCELEROMETER_BUFF_CAPACITY + 1] = {0};
+		uint8_t expected[LSM303DLHC_SAMPLE_TEXT_SIZE + 1] = {0};
+		acqBuff_read(acqbuff_Accelerometer, value);
+		lsm303dlhc_formatSample(&newest, expected);
+		if (strcmp((char *) value, (char *) expected) != 0) {
+			accelCheck.valueErrors++;
+		}
+		if (acqBuff_getTimestamp(acqbuff_Accelerometer) != newest.timestamp) {
+			accelCheck.timestampErrors++;
+		}
+	}
+}
+
+static void checkBarometer(uint32_t event, void * arg) {
+	if (!acqBuff_isNew(acqbuff_Barometer)) {
+		return;
+	}
+	uint8_t value[ACQBUFF_BAROMETER_BUFF_CAPACITY + 1] = {0};
+	acqBuff_read(acqbuff_Barometer, value);
+
+	struct mpl3115a2Model_stats stats;
+	mpl3115a2Model_getStats(&stats);
+	barometerCheck.count++;
+	// the driver writes the Q18.2 fraction as 0, 25, 50 or 75
+	if (strtod((char *) value, NULL) != stats.lastReadPressure / 4.0) {
+		barometerCheck.valueErrors++;
+	}
+	// a polled sample has the time of the poll, after the end of the conversion
+	uint32_t delay = acqBuff_getTimestamp(acqbuff_Barometer) - stats.lastReadEndMicros;
+	if ((!polling && delay != 0) || (polling && delay > POLLING_RATE_BAROMETER * 1000)) {
+		barometerCheck.timestampErrors++;
+	}
+}
+
+// runs once when created and once at the end of the simulation
+static void simStop(uint32_t event, void * arg) {
+	if ((int32_t) (sysTimer_GetTick() - simEnd) < 0) {
+		return;
+	}
+	scheduler_exit();
+}
+
+static void printBus(const char * name, McuDevice_I2C bus, uint32_t durationMs) {
+	struct i2cHost_stats stats;
+	i2cHost_getStats(bus, &stats);
+	printf("%-5s %7" PRIu32 " %6" PRIu32 " %7" PRIu32 " %9" PRIu64 " %6.2f\n", name, stats.jobCount,
+			stats.errorCount, stats.refusedCount, stats.byteCount, stats.busyMicros / (durationMs * 10.0));
+}
+
+static bool openSignal(struct sensorSignal * signal, const char * path, const struct sensorSignal_point * flight,
+		size_t flightCount) {
+	if (path != NULL) {
+		if (!sensorSignal_loadTrace(signal, path)) {
+			fprintf(stderr, "can't read the trace %s\n", path);
+			return false;
+		}
+		return true;
+	}
+	return sensorSignal_setTrace(signal, flight, flightCount);
+}
+
+int main(int argc, char ** argv) {
+	uint32_t seconds = 60;
+	uint32_t latencyMicros = 0;
+	double noiseScale = 1.0;
+	const char * pressurePath = NULL;
+	const char * accelPath = NULL;
+	bool verbose = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "t:l:n:p:a:iv")) != -1) {
+		switch (option) {
+		case 't':
+			seconds = (uint32_t) strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			latencyMicros = (uint32_t) strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			noiseScale = strtod(optarg, NULL);
+			break;
+		case 'p':
+			pressurePath = optarg;
+			break;
+		case 'a':
+			accelPath = optarg;
+			break;
+		case 'i':
+			polling = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds] [-l latency us] [-n noise scale] [-p pressure trace] "
+					"[-a accel trace] [-i] [-v]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (verbose) {
+		logging_open(writeStdout);
+		logging_setVerbosity(LOG_WARNING | LOG_CRITICAL);
+		logging_setTimestamp(true);
+	}
+
+	struct sensorSignal pressure;
+	struct sensorSignal accel;
+	sensorSignal_init(&pressure, 2, (double[]) {101325, 20.0}, 1);
+	sensorSignal_init(&accel, 3, (double[]) {0, 0, 1000}, 2);
+	sensorSignal_setNoise(&pressure, (double[]) {1.5 * noiseScale, 0.02 * noiseScale});
+	sensorSignal_setNoise(&accel, (double[]) {8 * noiseScale, 8 * noiseScale, 8 * noiseScale});
+	if (!openSignal(&pressure, pressurePath, flightPressure, sizeof(flightPressure) / sizeof(flightPressure[0]))
+			|| !openSignal(&accel, accelPath, flightAccel, sizeof(flightAccel) / sizeof(flightAccel[0]))) {
+		return 2;
+	}
+
+	struct lsm303dlhcModel_config accelConfig = {
+		.signal = &accel,
+		.int1Line = LSM303_INT1_EXTI_LINE,
+		.latencyMicros = latencyMicros,
+	};
+	struct mpl3115a2Model_config barometerConfig = {
+		.signal = &pressure,
+		.int1Line = MPL3115A2_INT1_EXTI_LINE,
+		.latencyMicros = latencyMicros,
+	};
+	lsm303dlhcModel_attach(mcuDevice_i2cBus1, &accelConfig);
+	mpl3115a2Model_attach(mcuDevice_i2cBus2, &barometerConfig);
+
+	extiHost_setOpenFails(polling);
+	sysTimerHost_setTick(0);
+	struct i2c_busConf busConfig = {
+		.clockSpeed = I2CHOST_CLOCKSPEED,
+		.addressingMode = I2C_ADDRESS_7BIT,
+	};
+	struct i2c_slaveDevice accelDevice = {0};
+	struct i2c_slaveDevice barometerDevice = {0};
+	i2c_open(mcuDevice_i2cBus1, &busConfig);
+	i2c_open(mcuDevice_i2cBus2, &busConfig);
+	if (lsm303dlhc_open(mcuDevice_i2cBus1, &accelDevice, POLLING_RATE_ACCEL) != DRIVER_STATUS_OK
+			|| mpl3115a2_open(mcuDevice_i2cBus2, &barometerDevice, POLLING_RATE_BAROMETER) != DRIVER_STATUS_OK) {
+		printf("FAILED: a driver didn't open\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+		struct task * task = createTask(loadRun, 0, (void *) &loads[i], loads[i].period, true, loads[i].priority);
+		scheduler_setPeriodMode(task, SCHEDULER_PERIOD_DEADLINE_SKIP);
+	}
+	createTask(checkAccel, 0, NULL, CHECK_ACCEL_INTERVAL_MS, true, TASK_PRIORITY_CHECK);
+	createTask(checkBarometer, 0, NULL, CHECK_BAROMETER_INTERVAL_MS, true, TASK_PRIORITY_CHECK);
+	simEnd = sysTimer_GetTick() + seconds * 1000;
+	struct task * stopTask = createTask(simStop, 0, NULL, seconds * 1000, true, 0);
+	scheduler_setPeriodMode(stopTask, SCHEDULER_PERIOD_DEADLINE_SKIP);
+
+	uint64_t start = sysTimerHost_nanos();
+	runScheduler();
+	uint64_t hostNanos = sysTimerHost_nanos() - start;
+	checkAccel(0, NULL);
+
+	struct lsm303dlhcModel_stats accelStats;
+	struct mpl3115a2Model_stats barometerStats;
+	lsm303dlhcModel_getStats(&accelStats);
+	mpl3115a2Model_getStats(&barometerStats);
+
+	printf("%" PRIu32 " s, transfer latency %" PRIu32 " us, noise x%.1f, %s, %s\n", seconds, latencyMicros,
+			noiseScale, (pressurePath != NULL || accelPath != NULL) ? "trace" : "synthetic flight",
+			polling ? "polling" : "interrupts");
+	printf("%-5s %7s %6s %7s %9s %6s\n", "bus", "jobs", "errors", "refused", "bytes", "busy%");
+	printBus("i2c1", mcuDevice_i2cBus1, seconds * 1000);
+	printBus("i2c2", mcuDevice_i2cBus2, seconds * 1000);
+
+	printf("%-10s %8s %8s %6s %11s %10s %8s %8s\n", "sensor", "samples", "read", "lost", "ageMean(us)",
+			"ageMax(us)", "checked", "mismatch");
+	printf("%-10s %8" PRIu32 " %8" PRIu32 " %6" PRIu32 " %11.1f %10" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n",
+			"accel", accelStats.sampleCount, accelStats.readCount, accelStats.lostCount,
+			(accelStats.readCount > 0) ? (double) accelStats.readAgeTotalMicros / accelStats.readCount : 0.0,
+			accelStats.readAgeMaxMicros, accelCheck.count, accelCheck.valueErrors + accelCheck.timestampErrors);
+	printf("%-10s %8" PRIu32 " %8" PRIu32 " %6" PRIu32 " %11.1f %10" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n",
+			"barometer", barometerStats.conversionCount, barometerStats.readCount, barometerStats.overwrittenCount,
+			(barometerStats.readCount > 0) ? (double) barometerStats.readAgeTotalMicros / barometerStats.readCount : 0.0,
+			barometerStats.readAgeMaxMicros, barometerCheck.count,
+			barometerCheck.valueErrors + barometerCheck.timestampErrors);
+	printf("accel timestamp error max %" PRIu32 " us, %" PRIu32 " int1 edges\n", accelCheck.timestampErrorMax,
+			accelStats.int1EdgeCount);
+	printf("host %.1f ms, %.0f ns per sample read\n", hostNanos / 1e6,
+			(double) hostNanos / (accelStats.readCount + barometerStats.readCount + 1));
+
+	sensorSignal_free(&pressure);
+	sensorSignal_free(&accel);
+
+	// the last conversion can end after the last read
+	bool passed = accelStats.lostCount == 0 && accelCheck.missing == 0 && accelStats.readLogDroppedCount == 0
+			&& accelCheck.valueErrors == 0 && accelCheck.timestampErrors == 0
+			&& accelCheck.count + 32 >= accelStats.sampleCount
+			&& barometerStats.overwrittenCount == 0 && barometerStats.readCount + 1 >= barometerStats.conversionCount
+			&& barometerCheck.valueErrors == 0 && barometerCheck.timestampErrors == 0 && barometerCheck.count > 0;
+	if (!passed) {
+		printf("FAILED: a sample was lost or doesn't match the model\n");
+	}
+	return passed ? 0 : 1;
+}
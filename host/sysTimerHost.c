@@ -0,0 +1,140 @@
+/**
+ * @file sysTimerHost.c
+ * @author Space Concordia Rocket Division
+ * @brief Virtual clock implementation of sysTimer.h for the host build.
+ */
+
+#include <stddef.h>
+#include <time.h>
+
+#include "sysTimerHost.h"
+
+#define INTERRUPT_SOURCES_MAX 8
+
+struct interruptSource {
+	bool (*next)(uint32_t * micros);
+	void (*raise)(void);
+};
+
+static uint64_t virtualMicros = 0;
+static uint32_t autoAdvanceCalls = 0;
+static uint32_t callsSinceTick = 0;
+static struct interruptSource sources[INTERRUPT_SOURCES_MAX];
+static size_t sourcesCount = 0;
+
+/*
+ * Finds the source with the earliest interrupt, an interrupt due in the past is due now.
+ */
+static struct interruptSource * nextInterrupt(uint64_t * due) {
+	struct interruptSource * first = NULL;
+	for (size_t i = 0; i < sourcesCount; i++) {
+		uint32_t micros;
+		if (!sources[i].next(&micros)) {
+			continue;
+		}
+		int32_t delta = (int32_t) (micros - (uint32_t) virtualMicros);
+		uint64_t sourceDue = (delta > 0) ? virtualMicros + (uint64_t) delta : virtualMicros;
+		if (first == NULL || sourceDue < *due) {
+			first = &sources[i];
+			*due = sourceDue;
+		}
+	}
+	return first;
+}
+
+/*
+ * Moves the virtual clock to target, stopping at each interrupt due on the way so the interrupt sees the
+ * time it was due.
+ */
+static void moveTo(uint64_t target) {
+	uint64_t due;
+	struct interruptSource * source;
+	while ((source = nextInterrupt(&due)) != NULL && due <= target) {
+		virtualMicros = due;
+		source->raise();
+	}
+	virtualMicros = target;
+}
+
+void sysTimer_init(void) {
+}
+
+uint32_t sysTimer_GetTick(void) {
+	if (autoAdvanceCalls > 0 && ++callsSinceTick >= autoAdvanceCalls) {
+		callsSinceTick = 0;
+		moveTo((virtualMicros / 1000 + 1) * 1000);
+	}
+	return (uint32_t) (virtualMicros / 1000);
+}
+
+uint32_t sysTimer_GetMicros(void) {
+	return (uint32_t) virtualMicros;
+}
+
+// Jumps the virtual clock to wakeTick, or to the next simulated interrupt if it comes first.
+uint32_t sysTimer_IdleUntil(uint32_t wakeTick, bool (*wakeUpPending)(void)) {
+	uint64_t start = virtualMicros;
+	int32_t sleepTicks = (int32_t) (wakeTick - (uint32_t) (start / 1000));
+	if (sleepTicks <= 0 || (wakeUpPending != NULL && wakeUpPending())) {
+		return 0;
+	}
+
+	uint64_t target = (start / 1000 + (uint64_t) sleepTicks) * 1000;
+	uint64_t due;
+	if (nextInterrupt(&due) != NULL && due < target) {
+		target = due;
+	}
+	moveTo(target);
+	return (uint32_t) (target - start);
+}
+
+// Sets the time without raising the interrupts on the way, eg. to restart a simulation.
+void sysTimerHost_setTick(uint32_t tick) {
+	virtualMicros = (uint64_t) tick * 1000;
+}
+
+void sysTimerHost_advance(uint32_t ms) {
+	moveTo(virtualMicros + (uint64_t) ms * 1000);
+}
+
+void sysTimerHost_advanceMicros(uint32_t micros) {
+	moveTo(virtualMicros + micros);
+}
+
+void sysTimerHost_setAutoAdvance(uint32_t callsPerTick) {
+	autoAdvanceCalls = callsPerTick;
+	callsSinceTick = 0;
+}
+
+bool sysTimerHost_addInterruptSource(bool (*next)(uint32_t * micros), void (*raise)(void)) {
+	if (next == NULL || raise == NULL || sourcesCount >= INTERRUPT_SOURCES_MAX) {
+		return false;
+	}
+	sources[sourcesCount].next = next;
+	sources[sourcesCount].raise = raise;
+	sourcesCount++;
+	return true;
+}
+
+void sysTimerHost_removeInterruptSource(void (*raise)(void)) {
+	for (size_t i = 0; i < sourcesCount; i++) {
+		if (sources[i].raise == raise) {
+			sources[i] = sources[--sourcesCount];
+			return;
+		}
+	}
+}
+
+// The host has no cycle counter, the monotonic clock in ns is used instead.
+void sysTimer_EnableCycleCounter(void) {
+}
+
+uint32_t sysTimer_GetCycles(void) {
+	return (uint32_t) sysTimerHost_nanos();
+}
+
+uint64_t sysTimerHost_nanos(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
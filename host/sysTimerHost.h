@@ -0,0 +1,51 @@
+/**
+ * @file sysTimerHost.h
+ * @author Space Concordia Rocket Division
+ * @brief Virtual clock implementation of sysTimer.h for the host build.
+ * 
+ * The virtual clock counts microseconds and only moves when the host program advances it, or by 1 ms
+ * every callsPerTick calls to sysTimer_GetTick() when auto advance is active. The tick is the
+ * milliseconds of the same clock.
+ * sysTimer_GetCycles() counts nanoseconds of the host monotonic clock.
+ * 
+ * Interrupt sources raise simulated interrupts at given times, eg. the edges of a sensor data ready pin
+ * or the end of an i2c transfer. The clock stops at each due time to raise the interrupt as it moves,
+ * and sysTimer_IdleUntil() wakes up early for it like on the board.
+ */
+
+#ifndef SYSTIMERHOST_H_
+#define SYSTIMERHOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sysTimer.h"
+
+void sysTimerHost_setTick(uint32_t tick);
+void sysTimerHost_advance(uint32_t ms);
+void sysTimerHost_advanceMicros(uint32_t micros);
+
+/**
+ * @brief Advance the virtual tick by 1 every callsPerTick calls to sysTimer_GetTick(). 
+ * 
+ * @param callsPerTick 0 to disable.
+ */
+void sysTimerHost_setAutoAdvance(uint32_t callsPerTick);
+
+/**
+ * @brief Add a simulated interrupt source, up to 8.
+ * 
+ * @param next sets micros to the sysTimer_GetMicros() time of the next interrupt, returns false if none.
+ * @param raise runs the interrupt at the time given by next, it must move next forward.
+ * @return false if there is no room left.
+ */
+bool sysTimerHost_addInterruptSource(bool (*next)(uint32_t * micros), void (*raise)(void));
+
+void sysTimerHost_removeInterruptSource(void (*raise)(void));
+
+/**
+ * @brief Host monotonic clock in nanoseconds, used to measure the real cost of the code.
+ */
+uint64_t sysTimerHost_nanos(void);
+
+#endif /* SYSTIMERHOST_H_ */
@@ -7,6 +7,10 @@
  * This driver currently only implements the accelerometer and fills its buffer
  * with the unscaled ADC value. To use call the open function with the I2C device 
  * connected to the accelerometer. The driver will initialize the device and create a scheduler task to run independently.
+ * 
+ * The samples are read from the device FIFO in batches, the newest sample of each batch is written to 
+ * acqbuff_Accelerometer with its time. Every sample is also queued with its estimated time for 
+ * lsm303dlhc_readSamples(), the data gatherer sends them on the bulk lane of the xbee.
  */
 
 
@@ -19,6 +23,18 @@
 #include "i2c.h"
 #include "main.h"
 
+#define LSM303DLHC_SAMPLE_TEXT_SIZE 20 // 3 signed 16 bit values and 2 separators
+
+/**
+ * @brief Accelerometer sample in the unscaled 12 bit ADC value.
+ */
+struct lsm303dlhc_sample {
+	uint32_t timestamp; // sysTimer_GetMicros() back-computed from the ODR
+	int16_t x;
+	int16_t y;
+	int16_t z;
+};
+
 /**
  * @brief initializes the driver and set up the recurring scheduler task
  * @param bus the initialized bus to use
@@ -27,4 +43,21 @@
  */
 int lsm303dlhc_open(McuDevice_I2C bus, struct i2c_slaveDevice * device, uint32_t msInterval);
 
+/**
+ * @brief Pop up to count of the oldest queued samples, from the main loop.
+ * 
+ * The queue holds the last 64 samples read, the oldest are dropped when it is full.
+ * 
+ * @return the count of samples copied to samplesOut.
+ */
+size_t lsm303dlhc_readSamples(struct lsm303dlhc_sample * samplesOut, size_t count);
+
+/**
+ * @brief Write the values of sample as "x#y#z" in ASCII, without a null character.
+ * 
+ * @param out at least LSM303DLHC_SAMPLE_TEXT_SIZE bytes.
+ * @return the count of characters written.
+ */
+size_t lsm303dlhc_formatSample(const struct lsm303dlhc_sample * sample, uint8_t * out);
+
 #endif /* __LSM303DLHC_H */
@@ -116,6 +116,13 @@ extern AcqBuff_Buffer acqbuff_Gyroscope;
  */
 size_t acqBuff_write(AcqBuff_Buffer buffer, uint8_t * data, size_t count);
 
+/**
+ * @brief Same as acqBuff_write() with the time of the sample, eg. taken in a data ready interrupt.
+ * 
+ * @param timestamp sysTimer_GetMicros() at the time of the sample.
+ */
+size_t acqBuff_writeAt(AcqBuff_Buffer buffer, uint8_t * data, size_t count, uint32_t timestamp);
+
 /**
  * @brief Reads the buffer to data up to the capacity of the buffer.
  * 
@@ -123,9 +130,25 @@ size_t acqBuff_write(AcqBuff_Buffer buffer, uint8_t * data, size_t count);
  */  
 size_t acqBuff_read(AcqBuff_Buffer buffer, uint8_t * data); 
 
+/**
+ * @brief Same as acqBuff_read() without the copy, dataOut is set to the data in the buffer.
+ * 
+ * The data is only valid until the next acqBuff_write() to the buffer.
+ * 
+ * @return count read from buffer.
+ */
+size_t acqBuff_readRef(AcqBuff_Buffer buffer, const uint8_t ** dataOut);
+
 /**
  * @brief Returns true if the buffer has new data since the last read.
  */
 bool acqBuff_isNew(AcqBuff_Buffer buffer);
 
+/**
+ * @brief Returns the time of the last acqBuff_write() to the buffer.
+ * 
+ * @return sysTimer_GetMicros() at the time of the write, or the time given to acqBuff_writeAt().
+ */
+uint32_t acqBuff_getTimestamp(AcqBuff_Buffer buffer);
+
 #endif /* __ACQ_BUFFERS_H */
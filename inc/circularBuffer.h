@@ -5,7 +5,17 @@
  * @brief Fifo circular queue adt.
  * 
  * To use create a struct circularBuffer and use buffer_attachArray to attach a fixed capacity mem
- * location for the buffer.
+ * location for the buffer. A power of 2 arraySize wraps the indexes with a mask instead of a
+ * comparison, the effective capacity is always arraySize - 1.
+ * 
+ * The buffer is safe without masking the interrupts for a single producer and a single consumer, eg. 
+ * an interrupt handler and the main loop. The producer owns back and only calls buffer_enqueue(), the
+ * consumer owns front and calls buffer_dequeue() or the peekLinear()/advanceLinear() pair. Each side
+ * publishes its index with a release store after the data is copied and reads the other side's index
+ * with an acquire load, the barriers compile to DMB on the cortex-m3.
+ * 
+ * The policy decides what buffer_enqueue() does when the elements don't fit, see enum buffer_policy.
+ * The stats count the dropped elements and the peak occupancy to size the arrays from real use.
  */
 
 #ifndef CIRCULARBUFFER_H_
@@ -20,26 +30,99 @@ enum buffer_status {
 	BUFFER_STATUS_ERROR,
 };
 
+/**
+ * @brief What buffer_enqueue() does with elements that don't fit in the free space.
+ */
+enum buffer_policy {
+	BUFFER_POLICY_REJECT_NEW, // enqueue what fits and drop the rest of the new elements, the default
+	BUFFER_POLICY_DROP_RECORD, // enqueue all the elements or none of them
+	/*
+	 * Drop the oldest elements not yet peeked by the consumer to make room for all the new elements.
+	 * With a record delimiter only whole records are dropped, a record being sent is kept up to its
+	 * end. The new elements are dropped like DROP_RECORD if the room can't be made, eg. when the
+	 * consumer holds most of the buffer with peekLinear().
+	 */
+	BUFFER_POLICY_OVERWRITE_OLDEST,
+};
+
+#define BUFFER_NO_DELIMITER (-1)
+
+/**
+ * @brief Counters of the producer side, reset by buffer_resetStats().
+ */
+struct buffer_stats {
+	uint32_t droppedBytes; // elements not enqueued or dropped from the buffer
+	uint32_t droppedWrites; // buffer_enqueue() calls that couldn't enqueue all the elements
+	size_t peakSize; // largest count of elements seen in the buffer
+};
+
+/**
+ * @brief A segment of a vectored enqueue.
+ */
+struct buffer_segment {
+	const uint8_t * data;
+	size_t size;
+};
+
 struct circularBuffer {
     //~ size_t size;
     size_t arraySize;
+    size_t indexMask; // arraySize - 1 if arraySize is a power of 2, 0 otherwise
     uint8_t * mem;
-    size_t front;
-    size_t back;
-    size_t peekLinearSize;
+    size_t front; // written by the consumer only
+    size_t back; // written by the producer only
+    size_t peekLinearSize; // consumer only
+    size_t peekEnd; // consumer only, front + peekLinearSize
+    enum buffer_policy policy;
+    int recordDelimiter;
+    uint8_t claimState; // only used by BUFFER_POLICY_OVERWRITE_OLDEST
+    struct buffer_stats stats; // producer only
 };
 
 int buffer_attachArray(struct circularBuffer * buffer, uint8_t * arrayStart, size_t arraySize);
 //~ int buffer_detachArray(struct circularBuffer * buffer); // Not currently needed
 
+/**
+ * @brief Set the policy of buffer_enqueue() when the elements don't fit, the default after 
+ * buffer_attachArray() is BUFFER_POLICY_REJECT_NEW.
+ * 
+ * Not safe while a producer or consumer is active.
+ * 
+ * @param recordDelimiter last element of each record for BUFFER_POLICY_OVERWRITE_OLDEST, eg. '\n', or
+ * BUFFER_NO_DELIMITER to drop single elements.
+ */
+int buffer_setPolicy(struct circularBuffer * buffer, enum buffer_policy policy, int recordDelimiter);
+
+/**
+ * @brief Copy the producer counters to stats, they can be one operation late from the consumer side.
+ */
+void buffer_getStats(struct circularBuffer * buffer, struct buffer_stats * stats);
+
+/**
+ * @brief Clear the producer counters, the peak starts again from the current size. Producer side.
+ */
+void buffer_resetStats(struct circularBuffer * buffer);
+
 
 /**
  * @brief Enqueue count of elements from element at the rear of the buffer.
  * 
+ * The elements that don't fit are handled according to the buffer policy.
+ * 
  * @return the number of elements successfully added to the buffer.
  */
 size_t buffer_enqueue(struct circularBuffer * buffer, uint8_t * element, size_t count);
 
+/**
+ * @brief Enqueue the count segments as one record, all of them or none.
+ * 
+ * The segments are published together, the consumer never sees a part of them. The policy applies to
+ * the whole record, BUFFER_POLICY_REJECT_NEW drops the record like BUFFER_POLICY_DROP_RECORD.
+ * 
+ * @return the total size enqueued, 0 if the record was dropped.
+ */
+size_t buffer_enqueuev(struct circularBuffer * buffer, const struct buffer_segment * segments, size_t count);
+
 /**
  * @brief dequeue count of elements into the out location.
  * 
@@ -47,6 +130,13 @@ size_t buffer_enqueue(struct circularBuffer * buffer, uint8_t * element, size_t
  */
 size_t buffer_dequeue(struct circularBuffer * buffer, uint8_t * out, size_t count);
 
+/**
+ * @brief Copy up to count elements from the front of the buffer without dequeuing them, consumer side.
+ * 
+ * @return the number of elements copied to out.
+ */
+size_t buffer_peek(struct circularBuffer * buffer, uint8_t * out, size_t count);
+
 /**
  * @brief get the maximal linearly consecutive elements possible in the memory.
  * 
@@ -61,11 +151,26 @@ size_t buffer_dequeue(struct circularBuffer * buffer, uint8_t * out, size_t coun
  */
 size_t buffer_peekLinear(struct circularBuffer * buffer, uint8_t ** startOut);
 
+/**
+ * @brief Same as buffer_peekLinear() with at most maxCount elements, eg. to stop at the end of a record.
+ */
+size_t buffer_peekLinearUpTo(struct circularBuffer * buffer, uint8_t ** startOut, size_t maxCount);
+
 /**
  * @brief Advance the front pointer by the amount of memory last peeked by peekLinear().
  */
 void buffer_advanceLinear(struct circularBuffer * buffer);
 
+/**
+ * @brief Enqueue the elements written up to the index back by an external writer, eg. a circular DMA
+ * into the array. Producer side.
+ * 
+ * The writer must not write more than the free space, the buffer can't detect it.
+ * 
+ * @return the count of elements enqueued.
+ */
+size_t buffer_commitIndex(struct circularBuffer * buffer, size_t back);
+
 /**
  * @brief Size of last peek that hasn't been advanced.
  */
@@ -73,9 +178,25 @@ static inline size_t buffer_peekSize(struct circularBuffer * buffer) {
 	return buffer->peekLinearSize;	
 }
 
+/**
+ * @brief Count of elements between the indexes front and back.
+ */
+static inline size_t buffer_countBetween(struct circularBuffer * buffer, size_t front, size_t back) {
+	if (buffer->indexMask != 0) {
+		return (back - front) & buffer->indexMask;
+	}
+	return (back >= front) ? (back - front) : (buffer->arraySize - front + back);
+}
+
+/**
+ * @brief Count of elements in the buffer, exact for the caller side, the other side can only make it 
+ * larger for the consumer or smaller for the producer.
+ */
 static inline size_t buffer_size(struct circularBuffer * buffer) {
 	//~ return buffer->size;
-	return (buffer->arraySize - buffer->front + buffer->back) % buffer->arraySize;
+	size_t back = __atomic_load_n(&buffer->back, __ATOMIC_ACQUIRE);
+	size_t front = __atomic_load_n(&buffer->front, __ATOMIC_ACQUIRE);
+	return buffer_countBetween(buffer, front, back);
 }
 
 #endif /* CIRCULARBUFFER_H_ */
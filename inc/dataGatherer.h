@@ -6,7 +6,8 @@
  *
  * The data_gatherer_init function adds a task to the scheduler that reads the
  * acquisition buffers of the sensors and sends their data to the xbee. The
- * format of the data is detailed in GS_InterfaceSchema.
+ * format of the data is detailed in GS_InterfaceSchema. The accelerometer
+ * samples queued by the LSM303DLHC driver follow on the bulk lane.
  * 
  */
 
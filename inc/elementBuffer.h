@@ -0,0 +1,70 @@
+/**
+ * @file elementBuffer.h
+ * @author Space Concordia Rocket Division
+ * @brief Fifo circular queue of fixed size elements, eg. binary sensor samples.
+ *
+ * The elements are stored in a circularBuffer and are always pushed, popped and peeked whole, an
+ * element can be any struct copyable with memcpy. The same single producer/single consumer rules as
+ * circularBuffer apply, push is the producer side and pop/peek are the consumer side.
+ *
+ * To use create a struct elementBuffer and a storage array of ELEMENTBUFFER_ARRAY_SIZE bytes, then
+ * attach it with elementBuffer_attachArray:
+ * 		static uint8_t samplesArray[ELEMENTBUFFER_ARRAY_SIZE(sizeof(struct sample), 32)];
+ * 		static struct elementBuffer samples;
+ * 		elementBuffer_attachArray(&samples, samplesArray, sizeof(samplesArray), sizeof(struct sample));
+ */
+
+#ifndef ELEMENTBUFFER_H_
+#define ELEMENTBUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "circularBuffer.h"
+
+/**
+ * @brief Size in bytes of the storage array for capacity elements of elementSize bytes.
+ */
+#define ELEMENTBUFFER_ARRAY_SIZE(elementSize, capacity) ((elementSize) * (capacity) + 1)
+
+struct elementBuffer {
+	struct circularBuffer bytes;
+	size_t elementSize;
+};
+
+/**
+ * @return BUFFER_STATUS_ERROR if the array can't hold at least one element.
+ */
+int elementBuffer_attachArray(struct elementBuffer * buffer, uint8_t * arrayStart, size_t arraySize,
+		size_t elementSize);
+
+/**
+ * @brief Push count elements at the rear of the buffer, only the elements that fit whole are pushed.
+ *
+ * @return the number of elements added to the buffer.
+ */
+size_t elementBuffer_push(struct elementBuffer * buffer, const void * elements, size_t count);
+
+/**
+ * @brief Pop up to count elements from the front of the buffer into out.
+ *
+ * @return the number of elements removed from the buffer.
+ */
+size_t elementBuffer_pop(struct elementBuffer * buffer, void * out, size_t count);
+
+/**
+ * @brief Copy up to count elements from the front of the buffer into out without removing them.
+ *
+ * @return the number of elements copied.
+ */
+size_t elementBuffer_peek(struct elementBuffer * buffer, void * out, size_t count);
+
+static inline size_t elementBuffer_count(struct elementBuffer * buffer) {
+	return buffer_size(&buffer->bytes) / buffer->elementSize;
+}
+
+static inline size_t elementBuffer_capacity(struct elementBuffer * buffer) {
+	return (buffer->bytes.arraySize - 1) / buffer->elementSize;
+}
+
+#endif /* ELEMENTBUFFER_H_ */
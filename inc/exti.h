@@ -0,0 +1,56 @@
+/**
+ * @file exti.h
+ * @author Space Concordia Rocket Division
+ * @brief External interrupt lines that post a timestamped scheduler event, eg. a sensor data ready pin.
+ *
+ * Each of the 16 EXTI lines is the pin of the same number on one of the GPIO ports. The interrupt reads
+ * sysTimer_GetMicros() first and posts the vector of the line with this time as the event, the sample
+ * time is known to a few us even when the main loop runs the event much later.
+ *
+ * The host build replaces exti.c with host/extiHost.c, the interrupts are then raised by a simulated
+ * source.
+ */
+
+#ifndef EXTI_H_
+#define EXTI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EXTI_LINES_COUNT 16
+
+enum exti_port {
+	EXTI_PORT_A,
+	EXTI_PORT_B,
+	EXTI_PORT_C,
+	EXTI_PORT_D,
+};
+
+enum exti_edge {
+	EXTI_EDGE_RISING,
+	EXTI_EDGE_FALLING,
+	EXTI_EDGE_BOTH,
+};
+
+/**
+ * @brief Configure the pin line of port as an input that posts vector on each edge.
+ *
+ * The event given to vector is sysTimer_GetMicros() at the start of the interrupt.
+ *
+ * @return false if the line or port is invalid or vector is NULL.
+ * @see scheduler_postEvent
+ */
+bool exti_open(enum exti_port port, uint8_t line, enum exti_edge edge, void (*vector)(uint32_t, void *),
+		void * argument, uint8_t priority);
+
+/**
+ * @brief Stop the interrupt of the line, an event already posted still runs.
+ */
+void exti_close(uint8_t line);
+
+/**
+ * @brief Count of the edges whose event was dropped because the scheduler event ring was full.
+ */
+uint32_t exti_getDroppedCount(uint8_t line);
+
+#endif /* EXTI_H_ */
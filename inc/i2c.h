@@ -5,11 +5,17 @@
  * @brief Interrupt or DMA based i2c device driver.
  * 
  * NOTE: Currently only the interrupt based transfer is implemented. 
+ * 
+ * Each bus has a queue of register transfers, the drivers submit a struct i2c_job with i2c_submit() and 
+ * get the completion as a scheduler event. The jobs of a bus run one after the other, the completion
+ * interrupt of a job posts the start of the next one to the main loop. The two buses run at the same time.
  */
 
 #ifndef __I2C_H
 #define __I2C_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "stm32f1xx.h"
 #include "mcuDevices.h"
 
@@ -69,6 +75,23 @@ struct i2c_slaveDevice {
 	McuDevice_I2C bus;
 };
 
+/**
+ * @brief A register read or write queued on the bus of its slave.
+ * 
+ * The data buffer must stay valid until the completion event, the job itself is copied by i2c_submit().
+ */
+struct i2c_job {
+	struct i2c_slaveDevice * slave;
+	uint16_t memoryAddress;
+	enum i2c_addressSize addSize;
+	uint8_t * data;
+	size_t size;
+	bool read;
+	void (*callback)(uint32_t, void *); // posted with an enum i2c_event and argument, can be NULL
+	void * argument;
+	uint8_t priority; // scheduler priority of the completion event
+};
+
 int i2c_open(McuDevice_I2C bus, struct i2c_busConf * conf);
 //~ int i2c_ioctl_setBus(McuDevice_I2C bus, int busSetMask, struct i2c_busConf * conf); 
 int i2c_ioctl_setSlave(McuDevice_I2C bus, struct i2c_slaveDevice * slave, 
@@ -79,10 +102,20 @@ int i2c_ioctl_setSlave(McuDevice_I2C bus, struct i2c_slaveDevice * slave,
 //~ int i2c_start(struct i2c_slaveDevice * slave);
 //~ int i2c_stop(struct i2c_slaveDevice * slave);
 
+/**
+ * @brief Queue a register transfer on the bus of job->slave, from the main loop only.
+ * 
+ * The job starts as soon as the jobs queued before it on the same bus are done, its callback is posted 
+ * to the scheduler with I2C_EVENT_RX_TRANSFER_DONE, I2C_EVENT_TX_TRANSFER_DONE or I2C_EVENT_ERROR.
+ * 
+ * @return I2C_STATUS_BUSY if the queue of the bus is full, I2C_STATUS_ERROR if the job is invalid.
+ */
+int i2c_submit(const struct i2c_job * job);
+
 /**
  * @brief Write a specified register to the slave device.
  * 
- * This is a non-blocking write. No callback implemented
+ * This is a non-blocking write queued with i2c_submit(). No callback implemented
  */
 int i2c_writeRegister(struct i2c_slaveDevice * slave, uint16_t memoryAddress, 
 		enum i2c_addressSize addSize, uint8_t * data, size_t size);
@@ -90,7 +123,8 @@ int i2c_writeRegister(struct i2c_slaveDevice * slave, uint16_t memoryAddress,
 /**
  * @brief Read a specified register from the slave device. 
  * 
- * This is a non-blocking read, the callback vector of the slave will be called when the transfer is completed.
+ * This is a non-blocking read queued with i2c_submit(), the callback vector of the slave will be called 
+ * when the transfer is completed.
  */
 int i2c_readRegister(struct i2c_slaveDevice * slave, uint16_t memoryAddress, enum i2c_addressSize addSize, 
 		uint8_t * data, size_t size);
@@ -98,7 +132,8 @@ int i2c_readRegister(struct i2c_slaveDevice * slave, uint16_t memoryAddress, enu
 /**
  * @brief Write a specified register to the slave device.
  * 
- * This is a blocking write as a temporary work-around.
+ * This is a blocking write as a temporary work-around, it returns I2C_STATUS_BUSY while a queued job 
+ * runs on the bus. Only for the initialization of the drivers.
  */
 int i2c_writeRegister_blocking(struct i2c_slaveDevice * slave, uint16_t memoryAddress, 
 		enum i2c_addressSize addSize, uint8_t * data, size_t size);
@@ -106,7 +141,8 @@ int i2c_writeRegister_blocking(struct i2c_slaveDevice * slave, uint16_t memoryAd
 /**
  * @brief Read a specified register from the slave device. 
  * 
- * This is a blocking read as a temporary work-around.
+ * This is a blocking read as a temporary work-around, it returns I2C_STATUS_BUSY while a queued job 
+ * runs on the bus. Only for the initialization of the drivers.
  */
 int i2c_readRegister_blocking(struct i2c_slaveDevice * slave, uint16_t memoryAddress, enum i2c_addressSize addSize, 
 		uint8_t * data, size_t size);
@@ -73,6 +73,13 @@ int logging_setVerbosity(int verbosity);
  */
 int logging_filterModule(uint8_t moduleIndex, bool filterOn);
 
+/**
+ * @brief Prefix every message with the sysTimer_GetMicros() time it was sent, off by default.
+ * 
+ * @param enable true to add the timestamp.
+ */
+int logging_setTimestamp(bool enable);
+
 /**
  * @brief Select the output function where the logging message are sent.
  */
@@ -94,6 +101,7 @@ int logging_send(char * message, uint8_t moduleIndex, enum logging_level level);
 #define logging_pause(__status__) ((void)0)
 #define logging_setVerbosity(__verbosity__) ((void)0)
 #define logging_filterModule(__moduleIndex__, __filterOn__) ((void)0)
+#define logging_setTimestamp(__enable__) ((void)0)
 #define logging_setOutput(__write__) ((void)0)
 #define logging_send(__message__, __level__) ((void)0)
 
@@ -35,6 +35,16 @@
 #define POLLING_RATE_BAROMETER 50
 #define POLLING_RATE_PITOT 50
 
+// Scheduler task priorities, 0 is the highest (see TASKS_PRIORITY_COUNT)
+
+#define TASK_PRIORITY_TELEMETRY 1
+#define TASK_PRIORITY_ACCEL 2
+#define TASK_PRIORITY_BAROMETER 3
+#define TASK_PRIORITY_PITOT 4
+#define TASK_PRIORITY_COMMANDS 5
+#define TASK_PRIORITY_MOCK_DEVICE 6
+#define TASK_PRIORITY_BLINK 7
+
 // Module index for logging control
 
 #define MODULE_INDEX_MAINTEST 0
@@ -14,14 +14,24 @@
 #define USART2_RX_PORT GPIOA
 #define USART2_TX_PIN GPIO_PIN_2
 #define USART2_RX_PIN GPIO_PIN_3
+#define USART2_TX_DMA_CHANNEL DMA1_Channel7 // shared with I2C1_RX
+#define USART2_TX_DMA_IRQ DMA1_Channel7_IRQn
+#define USART2_RX_DMA_CHANNEL DMA1_Channel6 // shared with I2C1_TX
+#define USART2_RX_DMA_IRQ DMA1_Channel6_IRQn
 
 #define USART1_DEVICE USART1
 #define USART1_TX_PORT GPIOA
 #define USART1_RX_PORT GPIOA
 #define USART1_RTS_PORT GPIOA
+#define USART1_CTS_PORT GPIOA
 #define USART1_TX_PIN GPIO_PIN_9
 #define USART1_RX_PIN GPIO_PIN_10
 #define USART1_RTS_PIN GPIO_PIN_12
+#define USART1_CTS_PIN GPIO_PIN_11
+#define USART1_TX_DMA_CHANNEL DMA1_Channel4 // shared with I2C2_TX
+#define USART1_TX_DMA_IRQ DMA1_Channel4_IRQn
+#define USART1_RX_DMA_CHANNEL DMA1_Channel5 // shared with I2C2_RX
+#define USART1_RX_DMA_IRQ DMA1_Channel5_IRQn
 
 #define I2C2_DEVICE I2C2
 #define I2C2_SCL_PORT GPIOB
@@ -46,4 +56,10 @@
 #define PITOT_CS_PORT GPIOB
 #define PITOT_CS_PIN GPIO_PIN_9
 
+// data ready interrupts of the sensors, see exti.h
+#define MPL3115A2_INT1_EXTI_PORT EXTI_PORT_B
+#define MPL3115A2_INT1_EXTI_LINE 0 // PB0
+#define LSM303_INT1_EXTI_PORT EXTI_PORT_B
+#define LSM303_INT1_EXTI_LINE 1 // PB1
+
 #endif /* __PINMAP_H */
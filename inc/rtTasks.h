@@ -0,0 +1,68 @@
+/**
+ * @file rtTasks.h
+ * @author Space Concordia Rocket Division
+ * @brief Preemptive tier for a few short fixed rate tasks, next to the cooperative scheduler.
+ *
+ * TIM4 gives the base tick at RT_TASKS_BASE_FREQUENCY. When a task is due, the TIM4 interrupt pends
+ * PendSV which runs the due tasks. PendSV has the lowest priority so the tasks preempt the cooperative
+ * scheduler, and any cooperative task blocked in a driver, but never delay the UART and I2C interrupts.
+ * The tasks run in order of their period, the shortest first.
+ *
+ * The tier is optional, build with RT_TASKS defined (RTTASKS in the Makefile) to include it.
+ *
+ * How to use:
+ * 	-Add the tasks with rtTasks_add() then start the tier with rtTasks_start().
+ * 	-A task must be short and must not block, it runs with the SysTick interrupt masked so
+ * 	  HAL_GetTick() doesn't advance and the blocking HAL functions would never time out.
+ * 	-A task must not call createTask() or destroyTask(), it hands its result to the cooperative
+ * 	  tasks with scheduler_postEvent() which is lock-free.
+ * 	-A run that is still pending or running when the task is due again counts as an overrun and
+ * 	  that period is skipped.
+ */
+
+#ifndef RTTASKS_H_
+#define RTTASKS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RT_TASKS_MAX_COUNT 4
+#define RT_TASKS_BASE_FREQUENCY 2000 // Hz, the periods are a multiple of the base period (500 us)
+
+#define RT_TASKS_TIMER_PRIORITY 1 // below the UART and I2C interrupts
+
+struct rtTasks_stats {
+	uint32_t runCount;
+	uint32_t overrunCount;
+	uint32_t runCyclesMax;
+};
+
+/**
+ * @brief Add a task called every periodMicros, must be called before rtTasks_start().
+ *
+ * @param periodMicros multiple of 1000000 / RT_TASKS_BASE_FREQUENCY.
+ * @return the task index for rtTasks_getStats(), DRIVER_STATUS_ERROR if the tier is started, full or
+ * 		the period is invalid.
+ */
+int rtTasks_add(void (*vector)(void *), void * argument, uint32_t periodMicros);
+
+/**
+ * @brief Start the base timer, the first run of every task is one period after the start.
+ *
+ * @return DRIVER_STATUS_ERROR if there is no task or it is already started.
+ */
+int rtTasks_start(void);
+
+/**
+ * @brief Stop the base timer and remove all the tasks.
+ */
+void rtTasks_stop(void);
+
+/**
+ * @brief Read the statistics of a task, the cycles are from sysTimer_GetCycles().
+ *
+ * @return false if the index is invalid.
+ */
+bool rtTasks_getStats(int index, struct rtTasks_stats * stats);
+
+#endif /* RTTASKS_H_ */
@@ -2,8 +2,8 @@
  * @file scheduler.h
  * @author Space Concordia Rocket division
  * @author Mathieu Breault
- * @brief Basic task scheduler for event based system, without pre-emption and minimal support
- * for priorities.
+ * @brief Basic task scheduler for event based system, without pre-emption and with support
+ * for up to 32 priorities.
  * 
  * This module can be used to handle recurring or non-recurring tasks or events with priorities.
  * The scheduler must always have 1 active task to work correctly, to prevent undefined behaviour,
@@ -13,11 +13,26 @@
  * How to use:
  * 	-Add a task with createTask() with a function pointer which will be called when the task/event
  * 	  is ready to run. The timeInterval is set according to the sysTimer.h implementation. The priority
- * 	  is between 0 and (TASKS_PRIORITY_COUNT - 1).
+ * 	  is between 0 and (TASKS_PRIORITY_COUNT - 1), 0 being the highest. The priority of each task
+ * 	  of the application is set in main.h.
  *  -Periodically update the scheduler with runScheduler(), it will update the task/event queue and
  *    call any ready tasks.
  *  -A task can destroy itself or an other task by using destroyTask(). This will fail if it is
  *    the last remaining tasks.
+ *  -A task can call scheduler_exit() to make runScheduler() return once it completes.
+ *  -Interrupt handlers must not call createTask() or destroyTask(), they post an event with
+ *    scheduler_postEvent() instead. The event is queued in a lock-free ring and runScheduler() turns
+ *    it into a non-repeated task.
+ *  -By default a repeated task runs again timeInterval after the end of its last run, so its period
+ *    drifts by its run time. Use scheduler_setPeriodMode() with a deadline mode for a fixed rate,
+ *    in this mode each run is due exactly timeInterval after the previous deadline.
+ *  -When nothing is ready, runScheduler() sleeps the core until the next task is due (see
+ *    sysTimer_IdleUntil()). scheduler_getIdleStats() gives the time slept, the CPU load is
+ *    1 - idleMicros / elapsed time.
+ * 
+ * Profiling:
+ * 	When SCHEDULER_PROFILING is defined, the run time in cycles (see sysTimer_GetCycles()) and the
+ * 	start latency in us (see sysTimer_GetMicros()) of every task is recorded and can be read with scheduler_getTaskStats().
  * 
  * Dependency:
  * 	sysTimer.h must be implemented to give a time interval.
@@ -26,18 +41,115 @@
 #ifndef SCHEDULER_H_
 #define SCHEDULER_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 
 #define TASKS_MAX_COUNT 24 // Limited to 256
-#define TASKS_PRIORITY_COUNT 3 // temporary
+#define TASKS_PRIORITY_COUNT 8 // Limited to 32, one bit per priority in the ready map
+
+#define SCHEDULER_EVENTS_MAX_COUNT 16 // Must be a power of 2
+
+#if TASKS_PRIORITY_COUNT > 32
+#error "TASKS_PRIORITY_COUNT is limited to 32"
+#endif
+
+#if (SCHEDULER_EVENTS_MAX_COUNT & (SCHEDULER_EVENTS_MAX_COUNT - 1)) != 0
+#error "SCHEDULER_EVENTS_MAX_COUNT must be a power of 2"
+#endif
 
 struct task;
 
+enum scheduler_periodMode {
+    SCHEDULER_PERIOD_FROM_END, // next run is timeInterval after the end of the last run (default)
+    SCHEDULER_PERIOD_DEADLINE_SKIP, // next run is the last deadline + timeInterval, missed periods are skipped
+    SCHEDULER_PERIOD_DEADLINE_BURST, // next run is the last deadline + timeInterval, missed periods run back to back
+};
+
 bool runScheduler(void);
 struct task * createTask(void (*vector)(uint32_t, void *), uint32_t event, void * argument,
 		uint32_t timeInterval, bool repeat, uint8_t priority);
 bool destroyTask(struct task *);
 
+/**
+ * @brief Request runScheduler() to return after the currently running task.
+ */
+void scheduler_exit(void);
+
+/**
+ * @brief Post an event to run vector as soon as possible, safe to call from any interrupt priority.
+ * 
+ * The event is copied to one of the SCHEDULER_EVENTS_MAX_COUNT preallocated slots without locking or
+ * masking the interrupts. runScheduler() creates a non-repeated task for it with the given priority,
+ * if no task is free the event stays queued until one is.
+ * 
+ * @return false if vector is NULL, priority is invalid or the event was dropped because all slots are used.
+ */
+bool scheduler_postEvent(void (*vector)(uint32_t, void *), uint32_t event, void * argument, uint8_t priority);
+
+/**
+ * @brief Count of the events dropped by scheduler_postEvent() because the event ring was full.
+ */
+uint32_t scheduler_getDroppedEventCount(void);
+
+/**
+ * @brief Set how the next run time of a repeated task is computed.
+ * 
+ * @return false if task is NULL.
+ */
+bool scheduler_setPeriodMode(struct task * task, enum scheduler_periodMode mode);
+
+/**
+ * @brief Count of periods where the task was still running or waiting when its next deadline passed.
+ * 
+ * Only counted in the deadline period modes, in SCHEDULER_PERIOD_DEADLINE_SKIP each skipped period
+ * counts as an overrun.
+ */
+uint32_t scheduler_getOverrunCount(struct task * task);
+
+struct scheduler_idleStats {
+    uint32_t sleepCount;
+    uint64_t idleMicros; // time the core slept
+    uint32_t sinceTick; // tick of the last scheduler_resetIdleStats()
+};
+
+/**
+ * @brief Read the time spent sleeping since the last scheduler_resetIdleStats().
+ */
+void scheduler_getIdleStats(struct scheduler_idleStats * stats);
+
+/**
+ * @brief Clear the idle statistics and start a new measurement window.
+ */
+void scheduler_resetIdleStats(void);
+
+#ifdef SCHEDULER_PROFILING
+
+struct scheduler_taskStats {
+    void (*vector)(uint32_t, void *);
+    uint32_t runCount;
+    uint32_t runCyclesMin;
+    uint32_t runCyclesMax;
+    uint64_t runCyclesTotal; // mean is runCyclesTotal / runCount
+    uint32_t startLatencyMin; // us between the time the task was due and its start
+    uint32_t startLatencyMax; // jitter is startLatencyMax - startLatencyMin
+    uint32_t overrunCount; // see scheduler_getOverrunCount()
+};
+
+/**
+ * @brief Read the profiling statistics of a task slot.
+ * 
+ * @param index slot of the task, between 0 and (TASKS_MAX_COUNT - 1)
+ * @return false if the slot is out of range or doesn't hold a task.
+ */
+bool scheduler_getTaskStats(size_t index, struct scheduler_taskStats * stats);
+
+/**
+ * @brief Clear the profiling statistics of all tasks.
+ */
+void scheduler_resetTaskStats(void);
+
+#endif /* SCHEDULER_PROFILING */
+
 #endif /* SCHEDULER_H_ */
@@ -9,7 +9,64 @@
 #define SYSTIMER_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
+/**
+ * @brief Start the free running microsecond clock.
+ * 
+ * TIM2 counts at 1 MHz and its update event clocks TIM3, the pair is read as a 32 bit counter that 
+ * wraps around every 71.6 minutes. Must be called after the system clock configuration.
+ */
+void sysTimer_init(void);
+
+/**
+ * @brief System tick in ms, the time base of the scheduler.
+ */
 uint32_t sysTimer_GetTick(void);
 
+/**
+ * @brief Microseconds since sysTimer_init(), wraps around every 2^32 us.
+ */
+uint32_t sysTimer_GetMicros(void);
+
+/**
+ * @brief Wrap safe comparison of two times of the same clock, true if a is after b.
+ * 
+ * Valid as long as the times are less than half the clock range apart, 24 days for the ms tick and
+ * 35 minutes for the us clock.
+ */
+static inline bool sysTimer_timeIsAfter(uint32_t a, uint32_t b) {
+    return ((int32_t) (b - a) < 0);
+}
+
+/**
+ * @brief Wrap safe comparison of two times of the same clock, true if a is before b.
+ */
+static inline bool sysTimer_timeIsBefore(uint32_t a, uint32_t b) {
+    return sysTimer_timeIsAfter(b, a);
+}
+
+/**
+ * @brief Sleep the core until the tick wakeTick or until any interrupt, whichever comes first.
+ * 
+ * The periodic tick interrupt is stopped for the duration of the sleep and the tick count is 
+ * corrected on wake up from the microsecond clock, it must be started with sysTimer_init(). wakeUpPending is called with the interrupts masked right before sleeping,
+ * if it returns true the core doesn't sleep, this closes the race with an interrupt that posted
+ * work after the caller decided to sleep.
+ * 
+ * @param wakeUpPending can be NULL.
+ * @return time slept in microseconds.
+ */
+uint32_t sysTimer_IdleUntil(uint32_t wakeTick, bool (*wakeUpPending)(void));
+
+/**
+ * @brief Start the free running cycle counter (DWT CYCCNT on the cortex-m3).
+ */
+void sysTimer_EnableCycleCounter(void);
+
+/**
+ * @brief Core clock cycles since the counter was enabled, wraps around every 2^32 cycles.
+ */
+uint32_t sysTimer_GetCycles(void);
+
 #endif /* SYSTIMER_H_ */
@@ -10,9 +10,11 @@
 #define __UART_H
 
 #include <stdint.h> 
+#include <stdbool.h>
 #include "stm32f1xx.h"
 #include "main.h"
 #include "mcuDevices.h"
+#include "circularBuffer.h"
 
 enum uart_ioSetMask {
     UART_IOSET_BAUDRATE = 0x01,
@@ -23,6 +25,16 @@ enum uart_ioSetMask {
     SERIAL_IOSET_INITALL = 0xFF,
 };
 
+/**
+ * @brief Max size of a bulk record, the urgent data waits at most for one bulk record to be sent.
+ */
+#define UART_BULK_RECORD_MAX_SIZE 64
+
+enum uart_lane {
+	UART_LANE_URGENT, // uart_write() and uart_writev()
+	UART_LANE_BULK, // uart_writeBulk()
+};
+
 struct uart_ioConf {
     uint32_t baudrate;
     uint32_t parity;
@@ -41,10 +53,128 @@ int uart_close(McuDevice_UART UARTx);
 /**
  * Writes the data buffer to the given USARTx
  * 
+ * When the transmit buffer is full the data is handled according to the policy set with 
+ * uart_setTxPolicy(), by default only the part that fits is written.
+ * 
  * @return the count of data written to the uart.
  */
 size_t uart_write(McuDevice_UART UARTx, uint8_t * data, size_t size);
 
+/**
+ * @brief Write the count segments as one record, eg. the fields of a telemetry frame.
+ * 
+ * The segments are queued together or not at all, a frame is never cut or interleaved with other 
+ * writes. The overwrite oldest policy can drop older records to make room.
+ * 
+ * @return the total size written, 0 if the record was rejected.
+ */
+size_t uart_writev(McuDevice_UART UARTx, const struct buffer_segment * segments, size_t count);
+
+/**
+ * @brief Queue data on the bulk lane, eg. a log dump, sent only when the urgent lane is empty.
+ * 
+ * The data is split in records of at most UART_BULK_RECORD_MAX_SIZE bytes that are queued whole or not
+ * at all, the urgent lane can only pass between two records.
+ * 
+ * @return the count of data queued, the records that didn't fit are dropped.
+ */
+size_t uart_writeBulk(McuDevice_UART UARTx, uint8_t * data, size_t size);
+
+/**
+ * @brief Set what uart_write() does when the urgent lane is full, call it after uart_open().
+ * 
+ * The bulk lane always drops the records that don't fit.
+ * 
+ * @see buffer_setPolicy
+ */
+int uart_setTxPolicy(McuDevice_UART UARTx, enum buffer_policy policy, int recordDelimiter);
+
+/**
+ * @brief Get the dropped bytes and the peak occupancy of a transmit lane.
+ */
+void uart_getTxStats(McuDevice_UART UARTx, enum uart_lane lane, struct buffer_stats * stats);
+
+/**
+ * @brief Clear the counters of both transmit lanes, from the context that writes to the uart.
+ */
+void uart_resetTxStats(McuDevice_UART UARTx);
+
+/**
+ * @brief Capacity in bytes of a transmit lane.
+ */
+size_t uart_txCapacity(McuDevice_UART UARTx, enum uart_lane lane);
+
+/**
+ * @brief Free space of a transmit lane, a write of up to this size is queued whole.
+ * 
+ * Only valid in the context that writes to the lane, the transmission can only free more space.
+ */
+size_t uart_txFree(McuDevice_UART UARTx, enum uart_lane lane);
+
+/**
+ * @brief Post vector as a scheduler event when a burst of data was received, NULL to stop.
+ * 
+ * The event is posted from the USART interrupt when the receive line goes idle, with the count of 
+ * bytes received in the burst as the event.
+ * 
+ * @see scheduler_postEvent
+ */
+void uart_setRxEvent(McuDevice_UART UARTx, void (*vector)(uint32_t, void *), void * argument,
+		uint8_t priority);
+
+/**
+ * @brief Count of received bytes waiting to be read.
+ */
+size_t uart_available(McuDevice_UART UARTx);
+
+/**
+ * @brief Count of receptions where data may have been lost since uart_open().
+ * 
+ * Counted when the reader falls behind a full receive buffer, and when the receive DMA interrupt is 
+ * held for more than half of the buffer, which can hide a whole lap of the DMA.
+ */
+uint32_t uart_getRxOverrunCount(McuDevice_UART UARTx);
+
+/**
+ * @brief Time the transmission of a UART with hardware flow control was held by its CTS input.
+ */
+struct uart_flowStats {
+	uint32_t stallCount; // times CTS was deasserted
+	uint32_t stallMicrosMax;
+	uint64_t stallMicrosTotal; // includes the current stall
+	bool stalled; // CTS is deasserted now
+};
+
+/**
+ * @brief Copy the CTS stall counters of the UART to stats.
+ * 
+ * @return false if the UART has no CTS flow control or stats is NULL.
+ */
+bool uart_getFlowStats(McuDevice_UART UARTx, struct uart_flowStats * stats);
+
+void uart_resetFlowStats(McuDevice_UART UARTx);
+
+#ifdef UART_IRQ_PROFILING
+/**
+ * @brief Cycles spent in the USART and DMA interrupt handlers of a UART.
+ */
+struct uart_irqStats {
+	uint32_t count; // handler calls
+	uint32_t bytes; // bytes received and sent by the handlers
+	uint32_t cyclesMax;
+	uint64_t cyclesTotal;
+};
+
+/**
+ * @brief Copy the interrupt counters of the UART to stats.
+ * 
+ * @return false if stats is NULL.
+ */
+bool uart_getIrqStats(McuDevice_UART UARTx, struct uart_irqStats * stats);
+
+void uart_resetIrqStats(McuDevice_UART UARTx);
+#endif
+
 /**
  * @brief Read from uart into data.
  * 
@@ -53,5 +183,9 @@ size_t uart_write(McuDevice_UART UARTx, uint8_t * data, size_t size);
  size_t uart_read(McuDevice_UART UARTx, uint8_t * data, size_t size);
 
 void USART2_IRQHandler(void);
+void DMA1_Channel4_IRQHandler(void);
+void DMA1_Channel5_IRQHandler(void);
+void DMA1_Channel6_IRQHandler(void);
+void DMA1_Channel7_IRQHandler(void);
 
 #endif /* __UART_H */
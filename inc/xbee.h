@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include "mcuDevices.h"
+#include "circularBuffer.h"
 
 /**
  * @brief Initialize the xbee module.
@@ -23,4 +24,28 @@ int xbee_open(McuDevice_UART UARTx);
 int xbee_close();
 int xbee_write(uint8_t * data, size_t size);
 
+/**
+ * @brief Queue data that can wait behind the telemetry, eg. a file download.
+ * 
+ * @see uart_writeBulk
+ * @return the count of data queued, 0 if the xbee isn't opened.
+ */
+size_t xbee_writeBulk(uint8_t * data, size_t size);
+
+/**
+ * @brief Free space of the bulk lane, a write of up to this size is queued whole.
+ * 
+ * @see uart_txFree
+ * @return 0 if the xbee isn't opened.
+ */
+size_t xbee_bulkFree(void);
+
+/**
+ * @brief Send the count segments as one frame, all of them or none.
+ * 
+ * @see uart_writev
+ * @return DRIVER_STATUS_ERROR if the xbee isn't opened or the frame was rejected.
+ */
+int xbee_writev(const struct buffer_segment * segments, size_t count);
+
 #endif /* __XBEE_H */
@@ -6,6 +6,21 @@
  * 
  * This driver currently only implements the accelerometer and fills its buffer
  * with the unscaled ADC value.
+ * 
+ * The accelerometer runs at LSM303_ODR_HZ with its 32 level FIFO in stream mode. The poll task reads
+ * FIFO_SRC_REG_A to get the count of unread samples, then all of them in one burst from OUT_X_L_A. With
+ * the FIFO enabled the auto-incremented address rolls back from OUT_Z_H_A to OUT_X_L_A, so each 6 bytes
+ * are the next sample. The poll interval must stay under 32 samples of the ODR or the oldest are lost.
+ * 
+ * The FIFO watermark interrupt is routed to INT1, wired to LSM303_INT1_EXTI_LINE. It rises when the
+ * FIFO holds more than LSM303_FIFO_WATERMARK samples and its event starts the drain, the time of the edge
+ * is then the time of the sample at index LSM303_FIFO_WATERMARK in the FIFO and the others are computed
+ * from it one ODR period apart. The poll task only drains when no watermark came during its interval,
+ * its newest sample is then at most one period older than the FIFO_SRC_REG_A read and is timestamped 
+ * half a period before it. The watermark must fill faster than the poll interval.
+ * 
+ * The newest sample goes to the acquisition buffer with its time, all of them are also queued for 
+ * lsm303dlhc_readSamples().
  */
 
 #include <stddef.h>
@@ -17,6 +32,10 @@
 #include "scheduler.h"
 #include "logging.h"
 #include "acquisitionBuffers.h"
+#include "elementBuffer.h"
+#include "sysTimer.h"
+#include "exti.h"
+#include "pinmapping.h"
 
 #define LSM303DLHC_ADDRESS_LIN_ACCEL (0b0011001)
 #define SEND_BUFFER_SIZE 32
@@ -55,12 +74,32 @@
 
 #define LSM303_REGISTER_AUTO_INC (0x80)
 
-// ODR 50Hz; Normal Mode (Low-power disabled); Z, Y, Z enabled
-#define LSM303_CONFIG_CTRL_REG1 0x47
+#define LSM303_FIFO_SRC_OVRN (0x40)
+#define LSM303_FIFO_SRC_EMPTY (0x20)
+#define LSM303_FIFO_SRC_FSS (0x1F)
+#define LSM303_FIFO_SIZE 32
+#define LSM303_SAMPLE_SIZE 6
+
+#define LSM303_FIFO_WATERMARK 15
+
+// I1_WTM (FIFO watermark interrupt on INT1)
+#define LSM303_CONFIG_CTRL_REG3 0x04
+
+// ODR 400Hz; Normal Mode (Low-power disabled); Z, Y, Z enabled
+#define LSM303_CONFIG_CTRL_REG1 0x77
+#define LSM303_ODR_HZ 400
+#define LSM303_PERIOD_MICROS (1000000 / LSM303_ODR_HZ)
 
 // FS = 11 (+- 16g full scale); HR = 0 (high resolution disabled)
 #define LSM303_CONFIG_CTRL_REG4 0x30
 
+// FIFO_EN
+#define LSM303_CONFIG_CTRL_REG5 0x40
+
+// FM = 10 (stream mode); FTH = LSM303_FIFO_WATERMARK
+#define LSM303_CONFIG_FIFO_CTRL_REG (0x80 | LSM303_FIFO_WATERMARK)
+
+#define SAMPLES_MAX_COUNT 64
 
 
 static uint8_t buffer[SEND_BUFFER_SIZE];
@@ -68,15 +107,31 @@ static uint8_t buffer[SEND_BUFFER_SIZE];
 static struct task * runTask = NULL;
 static char testBuffer[128];
 
-static void i2cCallback(uint32_t event, void * args);
+static struct elementBuffer samples;
+static uint8_t samplesArray[ELEMENTBUFFER_ARRAY_SIZE(sizeof(struct lsm303dlhc_sample), SAMPLES_MAX_COUNT)];
+
+// written by the i2c interrupt while transferPending
+static uint8_t fifoSource;
+static uint8_t fifoData[LSM303_FIFO_SIZE * LSM303_SAMPLE_SIZE];
+static bool transferPending = false;
+static size_t drainCount; // samples read by the current burst
+static uint32_t drainMicros; // time of the watermark edge, or of the FIFO_SRC_REG_A read
+static bool watermarkDrain; // drainMicros is the time of the sample at LSM303_FIFO_WATERMARK
+static bool interruptDrain; // the current drain was started by the watermark edge
+static bool drained = false; // by a watermark edge since the last poll
+
 static void runLoop(uint32_t event, void * args);
+static void watermarkReached(uint32_t event, void * args);
+static void readFifoSource(struct i2c_slaveDevice * slaveDevice);
+static void fifoSourceReceived(uint32_t event, void * args);
+static void fifoDataReceived(uint32_t event, void * args);
+static void writeAcquisition(const struct lsm303dlhc_sample * sample);
 
 int lsm303dlhc_open(McuDevice_I2C bus, struct i2c_slaveDevice * device, uint32_t msInterval) {
 	struct i2c_slaveConf config = {
 		.address = LSM303DLHC_ADDRESS_LIN_ACCEL,
-		.callback = i2cCallback
 	};
-	i2c_ioctl_setSlave(bus, device, I2C_SLAVESET_ADDRESS | I2C_SLAVESET_CALLBACK, &config);
+	i2c_ioctl_setSlave(bus, device, I2C_SLAVESET_ADDRESS, &config);
 	
 	uint8_t registerVal = LSM303_CONFIG_CTRL_REG1;
 	if (i2c_writeRegister_blocking(device, LSM303_REGISTER_ACCEL_CTRL_REG1_A, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
@@ -84,13 +139,40 @@ int lsm303dlhc_open(McuDevice_I2C bus, struct i2c_slaveDevice * device, uint32_t
 		return DRIVER_STATUS_ERROR;
 	}
 	
+	registerVal = LSM303_CONFIG_CTRL_REG3;
+	if (i2c_writeRegister_blocking(device, LSM303_REGISTER_ACCEL_CTRL_REG3_A, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
+		logging_send("set creg3", MODULE_INDEX_LSM303, LOG_WARNING);
+		return DRIVER_STATUS_ERROR;
+	}
+	
 	registerVal = LSM303_CONFIG_CTRL_REG4;
 	if (i2c_writeRegister_blocking(device, LSM303_REGISTER_ACCEL_CTRL_REG4_A, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
 		logging_send("set creg4", MODULE_INDEX_LSM303, LOG_WARNING);
 		return DRIVER_STATUS_ERROR;
 	}
 	
-	runTask = createTask(runLoop, 0, (void *) device, msInterval, true, 1);
+	registerVal = LSM303_CONFIG_CTRL_REG5;
+	if (i2c_writeRegister_blocking(device, LSM303_REGISTER_ACCEL_CTRL_REG5_A, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
+		logging_send("set creg5", MODULE_INDEX_LSM303, LOG_WARNING);
+		return DRIVER_STATUS_ERROR;
+	}
+	
+	registerVal = LSM303_CONFIG_FIFO_CTRL_REG;
+	if (i2c_writeRegister_blocking(device, LSM303_REGISTER_ACCEL_FIFO_CTRL_REG_A, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
+		logging_send("set fifo ctrl", MODULE_INDEX_LSM303, LOG_WARNING);
+		return DRIVER_STATUS_ERROR;
+	}
+	
+	elementBuffer_attachArray(&samples, samplesArray, sizeof(samplesArray), sizeof(struct lsm303dlhc_sample));
+	
+	// the poll task drains alone without it
+	if (!exti_open(LSM303_INT1_EXTI_PORT, LSM303_INT1_EXTI_LINE, EXTI_EDGE_RISING, watermarkReached, device,
+			TASK_PRIORITY_ACCEL)) {
+		logging_send("exti err", MODULE_INDEX_LSM303, LOG_WARNING);
+	}
+	
+	runTask = createTask(runLoop, 0, (void *) device, msInterval, true, TASK_PRIORITY_ACCEL);
+	scheduler_setPeriodMode(runTask, SCHEDULER_PERIOD_DEADLINE_SKIP);
 	
 	return DRIVER_STATUS_OK;
 }
@@ -102,67 +184,164 @@ static void runLoop(uint32_t event, void * args) {
 	UNUSED(event);
 	struct i2c_slaveDevice * slaveDevice = (struct i2c_slaveDevice *) args;
 	
-	uint8_t readData[6];
-	// Read all 6 register at once in order : xl, xh, yl, yh, zl, zh
-	i2c_readRegister_blocking(slaveDevice, (LSM303_REGISTER_ACCEL_OUT_X_L_A | LSM303_REGISTER_AUTO_INC), I2C_ADDRESS_SIZE_8BIT, readData, 6);
-	
-	int16_t x = 0, y = 0, z = 0;
-	
-	// div by 16 since it is a left-aligned 12 bit number (undocumented) (safe >> 4 signed)
-	x = (int16_t) (((uint16_t) readData[1] << 8) | (readData[0]))/16;
-	y = (int16_t) (((uint16_t) readData[3] << 8) | (readData[2]))/16;
-	z = (int16_t) (((uint16_t) readData[5] << 8) | (readData[4]))/16;
-	
-	
-	//~ sprintf(testBuffer, "%hhx %hhx", readData[0], readData[1]);
-	//~ logging_send(testBuffer, MODULE_INDEX_LSM303, LOG_DEBUG);
-	
-	//~ sprintf(testBuffer, "%hhx %hhx", readData[2], readData[3]);
-	//~ logging_send(testBuffer, MODULE_INDEX_LSM303, LOG_DEBUG);
+	if (drained) {
+		drained = false;
+		return;
+	}
+	if (transferPending) {
+		logging_send("i2c busy", MODULE_INDEX_LSM303, LOG_WARNING);
+		return;
+	}
+	watermarkDrain = false;
+	interruptDrain = false;
+	readFifoSource(slaveDevice);
+}
 
-	//~ sprintf(testBuffer, "%hhx %hhx", readData[4], readData[5]);
-	//~ logging_send(testBuffer, MODULE_INDEX_LSM303, LOG_DEBUG);
-	
-	sprintf(testBuffer, "x= %" PRId16 "; y= %" PRId16 "; z= %" PRId16, x, y, z);
-	logging_send(testBuffer, MODULE_INDEX_LSM303, LOG_DEBUG);
-	
-	//~ uint8_t ctrlReg = 0;
-	//~ i2c_readRegister_blocking(slaveDevice, LSM303_REGISTER_ACCEL_CTRL_REG1_A, I2C_ADDRESS_SIZE_8BIT, &ctrlReg, 1);
-	//~ sprintf(testBuffer, "ctrl1reg : %" 	PRIx8, ctrlReg);
-	//~ logging_send(testBuffer, MODULE_INDEX_LSM303, LOG_DEBUG);
+/**
+ * @param event sysTimer_GetMicros() at the watermark edge.
+ * @param args will contain the struct i2c_slaveDevice *.
+ */
+static void watermarkReached(uint32_t event, void * args) {
+	// a drain already running empties the FIFO below the watermark
+	if (transferPending) {
+		return;
+	}
+	drainMicros = event;
+	watermarkDrain = true;
+	interruptDrain = true;
+	readFifoSource((struct i2c_slaveDevice *) args);
+}
+
+static void readFifoSource(struct i2c_slaveDevice * slaveDevice) {
+	struct i2c_job job = {
+		.slave = slaveDevice,
+		.memoryAddress = LSM303_REGISTER_ACCEL_FIFO_SRC_REG_A,
+		.addSize = I2C_ADDRESS_SIZE_8BIT,
+		.data = &fifoSource,
+		.size = 1,
+		.read = true,
+		.callback = fifoSourceReceived,
+		.argument = slaveDevice,
+		.priority = TASK_PRIORITY_ACCEL,
+	};
+	if (i2c_submit(&job) == I2C_STATUS_OK) {
+		transferPending = true;
+	}
+}
+
+size_t lsm303dlhc_readSamples(struct lsm303dlhc_sample * samplesOut, size_t count) {
+	return elementBuffer_pop(&samples, samplesOut, count);
+}
+
+/**
+ * @param args will contain the struct i2c_slaveDevice *.
+ */
+static void fifoSourceReceived(uint32_t event, void * args) {
+	struct i2c_slaveDevice * slaveDevice = (struct i2c_slaveDevice *) args;
+	if (!watermarkDrain) {
+		drainMicros = sysTimer_GetMicros() - LSM303_PERIOD_MICROS / 2;
+	}
 	
-	//~ ctrlReg = 0;
-	//~ i2c_readRegister_blocking(slaveDevice, LSM303_REGISTER_ACCEL_CTRL_REG4_A, I2C_ADDRESS_SIZE_8BIT, &ctrlReg, 1);
-	//~ sprintf(testBuffer, "ctrl4reg : %" 	PRIx8, ctrlReg);
-	//~ logging_send(testBuffer, MODULE_INDEX_LSM303, LOG_DEBUG);
+	if (event != I2C_EVENT_RX_TRANSFER_DONE) {
+		logging_send("fifo src err", MODULE_INDEX_LSM303, LOG_WARNING);
+		transferPending = false;
+		return;
+	}
 	
-	int i = 0;
+	if (fifoSource & LSM303_FIFO_SRC_OVRN) {
+		// the FIFO is full and the oldest samples were overwritten
+		logging_send("fifo ovrn", MODULE_INDEX_LSM303, LOG_WARNING);
+		drainCount = LSM303_FIFO_SIZE;
+		// the sample at the watermark was overwritten
+		watermarkDrain = false;
+		drainMicros = sysTimer_GetMicros() - LSM303_PERIOD_MICROS / 2;
+	} else if (fifoSource & LSM303_FIFO_SRC_EMPTY) {
+		drainCount = 0;
+	} else {
+		drainCount = fifoSource & LSM303_FIFO_SRC_FSS;
+	}
+	if (drainCount == 0) {
+		transferPending = false;
+		return;
+	}
 	
-	if (x < 0) {
-		buffer[i++] = '-';
+	// Read all the samples at once in order : xl, xh, yl, yh, zl, zh for each
+	struct i2c_job job = {
+		.slave = slaveDevice,
+		.memoryAddress = (LSM303_REGISTER_ACCEL_OUT_X_L_A | LSM303_REGISTER_AUTO_INC),
+		.addSize = I2C_ADDRESS_SIZE_8BIT,
+		.data = fifoData,
+		.size = drainCount * LSM303_SAMPLE_SIZE,
+		.read = true,
+		.callback = fifoDataReceived,
+		.argument = slaveDevice,
+		.priority = TASK_PRIORITY_ACCEL,
+	};
+	if (i2c_submit(&job) != I2C_STATUS_OK) {
+		transferPending = false;
 	}
-	uint32_t convertValue = (uint32_t) (x < 0) ? -x : x;
-	i += ui2ascii(convertValue, buffer + i);
+}
+
+static void fifoDataReceived(uint32_t event, void * args) {
+	UNUSED(args);
+	transferPending = false;
 	
-	buffer[i++] = '#';
+	if (event != I2C_EVENT_RX_TRANSFER_DONE) {
+		logging_send("fifo read err", MODULE_INDEX_LSM303, LOG_WARNING);
+		return;
+	}
+	// the poll task skips its next drain, a drain of its own must not skip the one after
+	if (interruptDrain) {
+		drained = true;
+	}
 	
-	if (y < 0) {
-		buffer[i++] = '-';
+	struct lsm303dlhc_sample sample;
+	for (size_t n = 0; n < drainCount; n++) {
+		uint8_t * readData = fifoData + n * LSM303_SAMPLE_SIZE;
+		
+		// div by 16 since it is a left-aligned 12 bit number (undocumented) (safe >> 4 signed)
+		sample.x = (int16_t) (((uint16_t) readData[1] << 8) | (readData[0]))/16;
+		sample.y = (int16_t) (((uint16_t) readData[3] << 8) | (readData[2]))/16;
+		sample.z = (int16_t) (((uint16_t) readData[5] << 8) | (readData[4]))/16;
+		if (watermarkDrain) {
+			sample.timestamp = drainMicros + (uint32_t) ((int32_t) n - LSM303_FIFO_WATERMARK) * LSM303_PERIOD_MICROS;
+		} else {
+			sample.timestamp = drainMicros - (drainCount - 1 - n) * LSM303_PERIOD_MICROS;
+		}
+		
+		// keep the newest samples, the reader and this event both run in the main loop
+		if (elementBuffer_count(&samples) >= elementBuffer_capacity(&samples)) {
+			struct lsm303dlhc_sample oldest;
+			elementBuffer_pop(&samples, &oldest, 1);
+		}
+		elementBuffer_push(&samples, &sample, 1);
 	}
-	convertValue = (uint32_t) (y < 0) ? -y : y;
-	i += ui2ascii(convertValue, buffer + i);
 	
-	buffer[i++] = '#';
+	// the last sample is the newest
+	writeAcquisition(&sample);
+}
+
+size_t lsm303dlhc_formatSample(const struct lsm303dlhc_sample * sample, uint8_t * out) {
+	int16_t values[3] = {sample->x, sample->y, sample->z};
+	size_t i = 0;
 	
-	if (z < 0) {
-		buffer[i++] = '-';
+	for (size_t axis = 0; axis < 3; axis++) {
+		if (axis > 0) {
+			out[i++] = '#';
+		}
+		if (values[axis] < 0) {
+			out[i++] = '-';
+		}
+		uint32_t convertValue = (uint32_t) ((values[axis] < 0) ? -values[axis] : values[axis]);
+		i += ui2ascii(convertValue, out + i);
 	}
-	convertValue = (uint32_t) (z < 0) ? -z : z;
-	i += ui2ascii(convertValue, buffer + i);
-	
-	acqBuff_write(acqbuff_Accelerometer, buffer, i);
+	return i;
 }
 
-static void i2cCallback(uint32_t event, void * args) {
-	UNUSED(args);
+static void writeAcquisition(const struct lsm303dlhc_sample * sample) {
+	sprintf(testBuffer, "x= %" PRId16 "; y= %" PRId16 "; z= %" PRId16, sample->x, sample->y, sample->z);
+	logging_send(testBuffer, MODULE_INDEX_LSM303, LOG_DEBUG);
+	
+	size_t size = lsm303dlhc_formatSample(sample, buffer);
+	acqBuff_writeAt(acqbuff_Accelerometer, buffer, size, sample->timestamp);
 }
@@ -6,6 +6,19 @@
  * 
  * This driver currently only implements the barometer and fills its buffer
  * with the unscaled ADC value.
+ * 
+ * The device stays in standby and converts one sample per one shot (OST) trigger. The poll task reads 
+ * STATUS through OUT_T_LSB in one auto-incremented burst on the i2c queue. When the sample is ready the 
+ * completion event first queues the OST trigger of the next conversion, so it runs during the poll 
+ * interval, then converts the sample. The oversampling ratio is the highest whose conversion fits 
+ * the poll interval.
+ * 
+ * CTRL_REG1 is only written after the reset and never read back, ctrlReg1 is its shadow copy.
+ * 
+ * The data ready interrupt is routed to INT1, wired to MPL3115A2_INT1_EXTI_LINE. Its event starts the 
+ * burst read as soon as the conversion ends, with the time of the edge as the sample time, the samples
+ * then come at the conversion rate. The poll task only reads when no sample came during its interval,
+ * eg. after a missed edge.
  */
 
 #include <stddef.h>
@@ -18,6 +31,8 @@
 #include "logging.h"
 #include "acquisitionBuffers.h"
 #include "sysTimer.h"
+#include "exti.h"
+#include "pinmapping.h"
 
 #define SEND_BUFFER_SIZE 32
 
@@ -76,17 +91,44 @@ REGISTERS
 #define MPL3115A2_CTRL_REG1_BAR                 (0x00)
 #define MPL3115A2_CTRL_REG2                     (0x27)
 #define MPL3115A2_CTRL_REG3                     (0x28)
+#define MPL3115A2_CTRL_REG3_IPOL1               (0x20)
 #define MPL3115A2_CTRL_REG4                     (0x29)
+#define MPL3115A2_CTRL_REG4_INT_EN_DRDY         (0x80)
 #define MPL3115A2_CTRL_REG5                     (0x2A)
+#define MPL3115A2_CTRL_REG5_INT_CFG_DRDY        (0x80)
 
 #define MPL3115A2_REGISTER_STARTCONVERSION      (0x12)
 
-// Default Bar mode, non-active, ost 16x mode
-#define MPL3115A2_CTRL_REG1_VALUE (MPL3115A2_CTRL_REG1_BAR | MPL3115A2_CTRL_REG1_OS16)
+// Default Bar mode, standby, the oversampling is added from the poll interval
+#define MPL3115A2_CTRL_REG1_VALUE (MPL3115A2_CTRL_REG1_BAR)
 //Data flags enabled
 #define MPL3115A2_PT_DATA_CFG_VALUE	(MPL3115A2_PT_DATA_CFG_DREM |  MPL3115A2_PT_DATA_CFG_TDEFE | MPL3115A2_PT_DATA_CFG_PDEFE)
+// INT1 push-pull active high, data ready interrupt on INT1
+#define MPL3115A2_CTRL_REG3_VALUE (MPL3115A2_CTRL_REG3_IPOL1)
+#define MPL3115A2_CTRL_REG4_VALUE (MPL3115A2_CTRL_REG4_INT_EN_DRDY)
+#define MPL3115A2_CTRL_REG5_VALUE (MPL3115A2_CTRL_REG5_INT_CFG_DRDY)
 // TimeOut for reset
 #define TIME_OUT_RESET 5000
+// Polls without a ready sample before the one shot conversion is triggered again
+#define OST_RETRY_POLLS 4
+// STATUS, OUT_P_MSB, OUT_P_CSB, OUT_P_LSB, OUT_T_MSB, OUT_T_LSB
+#define BURST_SIZE 6
+
+struct oversampling {
+	uint8_t ctrlReg1;
+	uint32_t conversionMs; // minimum time between data samples in the datasheet
+};
+
+static const struct oversampling oversamplings[] = {
+	{MPL3115A2_CTRL_REG1_OS128, 512},
+	{MPL3115A2_CTRL_REG1_OS64, 258},
+	{MPL3115A2_CTRL_REG1_OS32, 130},
+	{MPL3115A2_CTRL_REG1_OS16, 66},
+	{MPL3115A2_CTRL_REG1_OS8, 34},
+	{MPL3115A2_CTRL_REG1_OS4, 18},
+	{MPL3115A2_CTRL_REG1_OS2, 10},
+	{MPL3115A2_CTRL_REG1_OS1, 6},
+};
 
 
 static uint8_t buffer[32];
@@ -94,20 +136,30 @@ static uint8_t buffer[32];
 static struct task * runTask = NULL;
 static char testBuffer[128];
 
-static void i2cCallback(uint32_t event, void * args);
-static void runLoop(uint32_t event, void * args);
+static uint8_t ctrlReg1; // shadow of CTRL_REG1
+static uint8_t ctrlReg1Trigger; // ctrlReg1 with OST, source of the queued trigger writes
+static uint32_t notReadyPolls = 0;
+static bool sampleCollected = false; // by a data ready edge since the last poll
 
-static inline bool timeIsAfter(uint32_t a, uint32_t b) {
-    return ((int32_t) (b - a) < 0);
+// written by the i2c interrupt while transferPending
+static uint8_t burstData[BURST_SIZE];
+static bool transferPending = false;
+static uint32_t sampleMicros; // edge of the data ready interrupt, or time of the poll
+static bool interruptRead; // the current burst was started by the data ready edge
 
-}
+static void runLoop(uint32_t event, void * args);
+static void dataReady(uint32_t event, void * args);
+static void readBurst(struct i2c_slaveDevice * slaveDevice);
+static uint8_t oversamplingFor(uint32_t msInterval);
+static void startConversion(struct i2c_slaveDevice * slaveDevice);
+static void conversionStarted(uint32_t event, void * args);
+static void burstReceived(uint32_t event, void * args);
 
 int mpl3115a2_open(McuDevice_I2C bus, struct i2c_slaveDevice * device, uint32_t msInterval) {
 	struct i2c_slaveConf config = {
 		.address = MPL3115A2_ADDRESS,
-		.callback = i2cCallback
 	};
-	i2c_ioctl_setSlave(bus, device, I2C_SLAVESET_ADDRESS | I2C_SLAVESET_CALLBACK, &config);
+	i2c_ioctl_setSlave(bus, device, I2C_SLAVESET_ADDRESS, &config);
 	
 	//~ // Reset the device for known value
 	uint8_t registerVal = MPL3115A2_CTRL_REG1_RST;
@@ -115,7 +167,10 @@ int mpl3115a2_open(McuDevice_I2C bus, struct i2c_slaveDevice * device, uint32_t
 	// Wait for the RST bit to clear
 	uint32_t timeOutLimit = sysTimer_GetTick() + TIME_OUT_RESET;
 	do {
-		registerVal = i2c_readRegister_blocking(device, MPL3115A2_CTRL_REG1, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1);
+		// the device doesn't answer during the reset
+		if (i2c_readRegister_blocking(device, MPL3115A2_CTRL_REG1, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
+			registerVal = MPL3115A2_CTRL_REG1_RST;
+		}
 		
 		sprintf(testBuffer, "ctrlReg1 %" PRIx8, registerVal);
 		logging_send(testBuffer, MODULE_INDEX_MPL311, LOG_DEBUG);
@@ -125,15 +180,15 @@ int mpl3115a2_open(McuDevice_I2C bus, struct i2c_slaveDevice * device, uint32_t
 		sprintf(testBuffer, "ctrlReg1 new %" PRIx8, registerVal);
 		logging_send(testBuffer, MODULE_INDEX_MPL311, LOG_DEBUG);
 
-		if (timeIsAfter(sysTimer_GetTick(), timeOutLimit)) {
+		if (sysTimer_timeIsAfter(sysTimer_GetTick(), timeOutLimit)) {
 			logging_send("timeOut rst MPL311", MODULE_INDEX_MPL311, LOG_CRITICAL);
 			return DRIVER_STATUS_ERROR;
 		} 
 	} while (registerVal);
 	
 	
-	registerVal = MPL3115A2_CTRL_REG1_VALUE;
-	if (i2c_writeRegister_blocking(device, MPL3115A2_CTRL_REG1, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
+	ctrlReg1 = MPL3115A2_CTRL_REG1_VALUE | oversamplingFor(msInterval);
+	if (i2c_writeRegister_blocking(device, MPL3115A2_CTRL_REG1, I2C_ADDRESS_SIZE_8BIT, &ctrlReg1, 1) != I2C_STATUS_OK) {
 		logging_send("set creg1 err", MODULE_INDEX_MPL311, LOG_WARNING);
 		return DRIVER_STATUS_ERROR;
 	}
@@ -144,13 +199,37 @@ int mpl3115a2_open(McuDevice_I2C bus, struct i2c_slaveDevice * device, uint32_t
 		return DRIVER_STATUS_ERROR;
 	}
 	
-	registerVal = MPL3115A2_CTRL_REG1_SBYB;
-	if (i2c_writeRegister_blocking(device, MPL3115A2_CTRL_REG1, I2C_ADDRESS_SIZE_8BIT, &registerVal, 1) != I2C_STATUS_OK) {
-		logging_send("set SBYB Active", MODULE_INDEX_MPL311, LOG_WARNING);
+	struct {
+		uint8_t address;
+		uint8_t value;
+	} interruptConfig[] = {
+		{MPL3115A2_CTRL_REG3, MPL3115A2_CTRL_REG3_VALUE},
+		{MPL3115A2_CTRL_REG4, MPL3115A2_CTRL_REG4_VALUE},
+		{MPL3115A2_CTRL_REG5, MPL3115A2_CTRL_REG5_VALUE},
+	};
+	for (size_t i = 0; i < LENGTH_OF_ARRAY(interruptConfig); i++) {
+		if (i2c_writeRegister_blocking(device, interruptConfig[i].address, I2C_ADDRESS_SIZE_8BIT, 
+				&interruptConfig[i].value, 1) != I2C_STATUS_OK) {
+			logging_send("set int err", MODULE_INDEX_MPL311, LOG_WARNING);
+			return DRIVER_STATUS_ERROR;
+		}
+	}
+	
+	// before the first conversion so its edge isn't missed, the poll task reads alone without it
+	if (!exti_open(MPL3115A2_INT1_EXTI_PORT, MPL3115A2_INT1_EXTI_LINE, EXTI_EDGE_RISING, dataReady, device,
+			TASK_PRIORITY_BAROMETER)) {
+		logging_send("exti err", MODULE_INDEX_MPL311, LOG_WARNING);
+	}
+	
+	// first conversion, the next ones are triggered as each sample is read
+	ctrlReg1Trigger = ctrlReg1 | MPL3115A2_CTRL_REG1_OST;
+	if (i2c_writeRegister_blocking(device, MPL3115A2_CTRL_REG1, I2C_ADDRESS_SIZE_8BIT, &ctrlReg1Trigger, 1) != I2C_STATUS_OK) {
+		logging_send("set OST err", MODULE_INDEX_MPL311, LOG_WARNING);
 		return DRIVER_STATUS_ERROR;
 	}
 	
-	runTask = createTask(runLoop, 0, (void *) device, msInterval, true, 1);
+	runTask = createTask(runLoop, 0, (void *) device, msInterval, true, TASK_PRIORITY_BAROMETER);
+	scheduler_setPeriodMode(runTask, SCHEDULER_PERIOD_DEADLINE_SKIP);
 	
 	return DRIVER_STATUS_OK;
 }
@@ -162,18 +241,118 @@ static void runLoop(uint32_t event, void * args) {
 	UNUSED(event);
 	struct i2c_slaveDevice * slaveDevice = (struct i2c_slaveDevice *) args;
 	
-	// Check if Data is ready
-	uint8_t registerData = 0;
-	i2c_readRegister_blocking(slaveDevice, MPL3115A2_REGISTER_STATUS,  I2C_ADDRESS_SIZE_8BIT, &registerData, 1);
+	if (sampleCollected) {
+		sampleCollected = false;
+		return;
+	}
+	if (transferPending) {
+		logging_send("i2c busy", MODULE_INDEX_MPL311, LOG_WARNING);
+		return;
+	}
+	sampleMicros = sysTimer_GetMicros();
+	interruptRead = false;
+	readBurst(slaveDevice);
+}
+
+/**
+ * @param event sysTimer_GetMicros() at the data ready edge.
+ * @param args will contain the struct i2c_slaveDevice *.
+ */
+static void dataReady(uint32_t event, void * args) {
+	if (transferPending) {
+		return;
+	}
+	sampleMicros = event;
+	interruptRead = true;
+	readBurst((struct i2c_slaveDevice *) args);
+}
+
+static void readBurst(struct i2c_slaveDevice * slaveDevice) {
+	// STATUS and the sample in one burst, the register address auto-increments
+	struct i2c_job job = {
+		.slave = slaveDevice,
+		.memoryAddress = MPL3115A2_REGISTER_STATUS,
+		.addSize = I2C_ADDRESS_SIZE_8BIT,
+		.data = burstData,
+		.size = BURST_SIZE,
+		.read = true,
+		.callback = burstReceived,
+		.argument = slaveDevice,
+		.priority = TASK_PRIORITY_BAROMETER,
+	};
+	if (i2c_submit(&job) == I2C_STATUS_OK) {
+		transferPending = true;
+	}
+}
+
+// highest oversampling ratio that converts within the poll interval
+static uint8_t oversamplingFor(uint32_t msInterval) {
+	for (size_t i = 0; i < LENGTH_OF_ARRAY(oversamplings); i++) {
+		if (oversamplings[i].conversionMs < msInterval) {
+			return oversamplings[i].ctrlReg1;
+		}
+	}
+	return MPL3115A2_CTRL_REG1_OS1;
+}
+
+// queue the one shot trigger, the OST bit clears itself at the end of the conversion
+static void startConversion(struct i2c_slaveDevice * slaveDevice) {
+	ctrlReg1Trigger = ctrlReg1 | MPL3115A2_CTRL_REG1_OST;
+	struct i2c_job job = {
+		.slave = slaveDevice,
+		.memoryAddress = MPL3115A2_CTRL_REG1,
+		.addSize = I2C_ADDRESS_SIZE_8BIT,
+		.data = &ctrlReg1Trigger,
+		.size = 1,
+		.read = false,
+		.callback = conversionStarted,
+		.argument = slaveDevice,
+		.priority = TASK_PRIORITY_BAROMETER,
+	};
+	if (i2c_submit(&job) != I2C_STATUS_OK) {
+		logging_send("OST queue full", MODULE_INDEX_MPL311, LOG_WARNING);
+	}
+}
+
+static void conversionStarted(uint32_t event, void * args) {
+	UNUSED(args);
+	if (event != I2C_EVENT_TX_TRANSFER_DONE) {
+		logging_send("OST write err", MODULE_INDEX_MPL311, LOG_WARNING);
+	}
+}
+
+/**
+ * @param args will contain the struct i2c_slaveDevice *.
+ */
+static void burstReceived(uint32_t event, void * args) {
+	struct i2c_slaveDevice * slaveDevice = (struct i2c_slaveDevice *) args;
+	transferPending = false;
+	
+	if (event != I2C_EVENT_RX_TRANSFER_DONE) {
+		logging_send("burst read err", MODULE_INDEX_MPL311, LOG_WARNING);
+		return;
+	}
 	
-	if (!(registerData & MPL3115A2_REGISTER_STATUS_PDR)) {
+	if (!(burstData[0] & MPL3115A2_REGISTER_STATUS_PDR)) {
 		logging_send("data nrdy", MODULE_INDEX_MPL311, LOG_WARNING);
+		// the trigger was lost, eg. on a bus error
+		if (++notReadyPolls >= OST_RETRY_POLLS) {
+			notReadyPolls = 0;
+			startConversion(slaveDevice);
+		}
 		return;
 	}
+	notReadyPolls = 0;
+	// only a sample of the interrupt skips the next poll, the polling fallback reads every interval
+	if (interruptRead) {
+		sampleCollected = true;
+	}
+	
+	// the next conversion runs while this sample is converted and until the next poll
+	startConversion(slaveDevice);
 	
-	uint8_t readData[5];
+	uint8_t * readData = burstData + 1;
 	uint8_t * pMSB = readData, * pCSB = readData + 1, * pLSB = readData + 2, * tMSB = readData + 3, * tLSB = readData + 4;
-	i2c_readRegister_blocking(slaveDevice, MPL3115A2_REGISTER_PRESSURE_MSB, I2C_ADDRESS_SIZE_8BIT, readData, 5);
 	
 	sprintf(testBuffer, "MPL msb: %" PRIx8", csb: %" PRIx8 ", lsb: %" PRIx8, *pMSB, *pCSB, *pLSB);
 	logging_send(testBuffer, MODULE_INDEX_MPL311, LOG_DEBUG);
@@ -210,7 +389,7 @@ static void runLoop(uint32_t event, void * args) {
 	sprintf(testBuffer, "bar val %" PRId32, convertValue);
 	logging_send(testBuffer, MODULE_INDEX_MPL311, LOG_DEBUG);
 	
-	acqBuff_write(acqbuff_Barometer, buffer, i);
+	acqBuff_writeAt(acqbuff_Barometer, buffer, i, sampleMicros);
 	
 	
 	
@@ -220,7 +399,7 @@ static void runLoop(uint32_t event, void * args) {
 	// Complement to a 32 bit neg number if it's negative
 
 	// Droping the LSB to simplify the conversion to ascii since then step are .125 instead of 0.0625
-	fracPart = (*pLSB >> 5);
+	fracPart = (*tLSB >> 5);
 	
 	decValue = (int32_t) tIntPart;
 	
@@ -242,9 +421,5 @@ static void runLoop(uint32_t event, void * args) {
 	sprintf(testBuffer, "temp val %" PRId32, convertValue);
 	logging_send(testBuffer, MODULE_INDEX_MPL311, LOG_DEBUG);
 	
-	acqBuff_write(acqbuff_Gyroscope, buffer, i);
-}
-
-static void i2cCallback(uint32_t event, void * args) {
-	UNUSED(args);
+	acqBuff_writeAt(acqbuff_Gyroscope, buffer, i, sampleMicros);
 }
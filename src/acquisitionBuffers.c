@@ -14,6 +14,7 @@
 #include <string.h>
 
 #include "acquisitionBuffers.h"
+#include "sysTimer.h"
 
 /*
  * Buffer size in bytes define
@@ -24,6 +25,7 @@ struct entry {
 	uint8_t * buffer;
 	size_t bufferCapacity;
 	size_t bufferSize;
+	uint32_t timestamp; // us
 };
 
 /*
@@ -105,6 +107,10 @@ AcqBuff_Buffer acqbuff_Gyroscope = &gyroscope_entry;
 
 
 size_t acqBuff_write(AcqBuff_Buffer buffer, uint8_t * data, size_t count) {
+	return acqBuff_writeAt(buffer, data, count, sysTimer_GetMicros());
+}
+
+size_t acqBuff_writeAt(AcqBuff_Buffer buffer, uint8_t * data, size_t count, uint32_t timestamp) {
 	struct entry * bufferEntry = (struct entry *) buffer;
 	
 	int i;
@@ -113,6 +119,7 @@ size_t acqBuff_write(AcqBuff_Buffer buffer, uint8_t * data, size_t count) {
 	}
 	bufferEntry->newData = true;
 	bufferEntry->bufferSize = i;
+	bufferEntry->timestamp = timestamp;
 	
 	return (size_t) i;
 }
@@ -132,12 +139,26 @@ size_t acqBuff_read(AcqBuff_Buffer buffer, uint8_t * data) {
 	return (size_t) i;
 }
 
+size_t acqBuff_readRef(AcqBuff_Buffer buffer, const uint8_t ** dataOut) {
+	struct entry * bufferEntry = (struct entry *) buffer;
+	
+	*dataOut = bufferEntry->buffer;
+	bufferEntry->newData = false;
+	return bufferEntry->bufferSize;
+}
+
 bool acqBuff_isNew(AcqBuff_Buffer buffer) {
 	struct entry * bufferEntry = (struct entry *) buffer;
 	
 	return bufferEntry->newData;
 }
 
+uint32_t acqBuff_getTimestamp(AcqBuff_Buffer buffer) {
+	struct entry * bufferEntry = (struct entry *) buffer;
+	
+	return bufferEntry->timestamp;
+}
+
 
 
 
@@ -8,12 +8,154 @@
  * The tail must point to the first empty location to simplify the implementation, therefore the 
  * effective capacity of the queue is arraySize - 1.
  * 
+ * With BUFFER_POLICY_OVERWRITE_OLDEST the producer moves the unread elements after peekEnd to drop the
+ * oldest ones, so the consumer takes claimState while it reads back and sets peekEnd. Neither side
+ * ever waits for the claim: the consumer reads nothing and the producer drops the new elements, so
+ * either side can still be an interrupt handler. The elements peeked with peekLinear() stay in place.
  */
  
+#include <string.h>
+#include <stdbool.h>
+
 #include "circularBuffer.h"
 
-static inline size_t remainingCapacity(struct circularBuffer * buffer) {
-	return (buffer_size(buffer) - buffer->arraySize - 1);
+enum claimState {
+	CLAIM_IDLE,
+	CLAIM_CONSUMER,
+	CLAIM_PRODUCER,
+};
+
+/*
+ * Wrap an index that is less than 2 * arraySize, it is always the case for front or back plus a count
+ * limited by the buffer size.
+ */
+static inline size_t wrapIndex(struct circularBuffer * buffer, size_t index) {
+	if (buffer->indexMask != 0) {
+		return index & buffer->indexMask;
+	}
+	return (index >= buffer->arraySize) ? (index - buffer->arraySize) : index;
+}
+
+// copy count elements starting at the index front, up to the end of the array then from its start
+static inline void copyOut(struct circularBuffer * buffer, size_t front, uint8_t * out, size_t count) {
+	size_t firstCount = buffer->arraySize - front;
+	if (firstCount > count) {
+		firstCount = count;
+	}
+	memcpy(out, buffer->mem + front, firstCount);
+	memcpy(out + firstCount, buffer->mem, count - firstCount);
+}
+
+static inline bool takeClaim(struct circularBuffer * buffer, uint8_t owner) {
+	uint8_t idle = CLAIM_IDLE;
+	return __atomic_compare_exchange_n(&buffer->claimState, &idle, owner, false, __ATOMIC_ACQUIRE,
+			__ATOMIC_RELAXED);
+}
+
+static inline void releaseClaim(struct circularBuffer * buffer) {
+	__atomic_store_n(&buffer->claimState, CLAIM_IDLE, __ATOMIC_RELEASE);
+}
+
+static inline bool consumerClaim(struct circularBuffer * buffer) {
+	return buffer->policy != BUFFER_POLICY_OVERWRITE_OLDEST || takeClaim(buffer, CLAIM_CONSUMER);
+}
+
+static inline void consumerRelease(struct circularBuffer * buffer) {
+	if (buffer->policy == BUFFER_POLICY_OVERWRITE_OLDEST) {
+		releaseClaim(buffer);
+	}
+}
+
+/*
+ * Offset after the first record delimiter at or after the offset from, relative to start. Returns
+ * count + 1 if there is none before count.
+ */
+static size_t recordEnd(struct circularBuffer * buffer, size_t start, size_t from, size_t count) {
+	for (size_t i = from; i < count; i++) {
+		if (buffer->mem[wrapIndex(buffer, start + i)] == (uint8_t) buffer->recordDelimiter) {
+			return i + 1;
+		}
+	}
+	return count + 1;
+}
+
+/*
+ * Drop at least count of the oldest unpeeked elements by moving the newer ones over them, producer
+ * side. The element before peekEnd was already consumed or is peeked, it is never overwritten by the
+ * producer and tells if peekEnd is at the start of a record.
+ */
+static bool dropOldest(struct circularBuffer * buffer, size_t count) {
+	if (!takeClaim(buffer, CLAIM_PRODUCER)) {
+		return false;
+	}
+	
+	// peekEnd can't change while the claim is held, front can only move up to it
+	size_t start = __atomic_load_n(&buffer->peekEnd, __ATOMIC_RELAXED);
+	size_t back = buffer->back;
+	size_t unread = buffer_countBetween(buffer, start, back);
+	size_t dropStart = 0;
+	size_t dropEnd = count;
+	if (buffer->recordDelimiter != BUFFER_NO_DELIMITER) {
+		uint8_t previous = buffer->mem[wrapIndex(buffer, start + buffer->arraySize - 1)];
+		if (previous != (uint8_t) buffer->recordDelimiter) {
+			dropStart = recordEnd(buffer, start, 0, unread);
+		}
+		dropEnd = recordEnd(buffer, start, dropStart + count - 1, unread);
+	}
+	if (dropEnd > unread) {
+		releaseClaim(buffer);
+		return false;
+	}
+	
+	size_t kept = unread - dropEnd;
+	for (size_t i = 0; i < kept; i++) {
+		buffer->mem[wrapIndex(buffer, start + dropStart + i)] = buffer->mem[wrapIndex(buffer, start + dropEnd + i)];
+	}
+	__atomic_store_n(&buffer->back, wrapIndex(buffer, start + dropStart + kept), __ATOMIC_RELEASE);
+	buffer->stats.droppedBytes += dropEnd - dropStart;
+	
+	releaseClaim(buffer);
+	return true;
+}
+
+// producer side, after the elements are published
+static inline void updatePeak(struct circularBuffer * buffer, size_t back) {
+	size_t size = buffer_countBetween(buffer, __atomic_load_n(&buffer->front, __ATOMIC_ACQUIRE), back);
+	if (size > buffer->stats.peakSize) {
+		buffer->stats.peakSize = size;
+	}
+}
+
+// copy count elements at the index back, up to the end of the array then from its start
+static inline void copyIn(struct circularBuffer * buffer, size_t back, const uint8_t * elements, size_t count) {
+	size_t firstCount = buffer->arraySize - back;
+	if (firstCount > count) {
+		firstCount = count;
+	}
+	memcpy(buffer->mem + back, elements, firstCount);
+	memcpy(buffer->mem, elements + firstCount, count - firstCount);
+}
+
+/*
+ * Make room for count elements according to the policy, producer side. Returns the count that can be
+ * copied at back: count, 0, or the free space if partial is true.
+ */
+static size_t makeRoom(struct circularBuffer * buffer, size_t count, bool partial) {
+	// the consumer frees the elements before front with a release store
+	size_t front = __atomic_load_n(&buffer->front, __ATOMIC_ACQUIRE);
+	size_t capacity = buffer->arraySize - 1 - buffer_countBetween(buffer, front, buffer->back);
+	if (count <= capacity) {
+		return count;
+	}
+	
+	if (buffer->policy == BUFFER_POLICY_OVERWRITE_OLDEST && count < buffer->arraySize
+			&& dropOldest(buffer, count - capacity)) {
+		return count;
+	}
+	size_t kept = partial ? capacity : 0;
+	buffer->stats.droppedBytes += count - kept;
+	buffer->stats.droppedWrites++;
+	return kept;
 }
 
 int buffer_attachArray(struct circularBuffer * buffer, uint8_t * arrayStart, size_t arraySize) {
@@ -21,49 +163,169 @@ int buffer_attachArray(struct circularBuffer * buffer, uint8_t * arrayStart, siz
 		return BUFFER_STATUS_ERROR;
 	}
 	
+	// not safe while a producer or consumer is active
 	//~ buffer->size = 0;
 	buffer->arraySize = arraySize;
+	buffer->indexMask = ((arraySize & (arraySize - 1)) == 0) ? (arraySize - 1) : 0;
 	buffer->mem = arrayStart;
 	buffer->front = 0;
 	buffer->back = 0;
+	buffer->peekLinearSize = 0;
+	buffer->peekEnd = 0;
+	buffer->policy = BUFFER_POLICY_REJECT_NEW;
+	buffer->recordDelimiter = BUFFER_NO_DELIMITER;
+	buffer->claimState = CLAIM_IDLE;
+	buffer->stats.droppedBytes = 0;
+	buffer->stats.droppedWrites = 0;
+	buffer->stats.peakSize = 0;
+	
+	return BUFFER_STATUS_OK;
+}
+
+int buffer_setPolicy(struct circularBuffer * buffer, enum buffer_policy policy, int recordDelimiter) {
+	if (buffer == NULL || recordDelimiter < BUFFER_NO_DELIMITER || recordDelimiter > UINT8_MAX) {
+		return BUFFER_STATUS_ERROR;
+	}
 	
+	buffer->policy = policy;
+	buffer->recordDelimiter = recordDelimiter;
 	return BUFFER_STATUS_OK;
 }
 
+void buffer_getStats(struct circularBuffer * buffer, struct buffer_stats * stats) {
+	*stats = buffer->stats;
+}
+
+void buffer_resetStats(struct circularBuffer * buffer) {
+	buffer->stats.droppedBytes = 0;
+	buffer->stats.droppedWrites = 0;
+	buffer->stats.peakSize = buffer_size(buffer);
+}
+
+/*
+ * The data is copied in at most 2 segments, up to the end of the array then from its start. A single
+ * element, the UART receive interrupt case, is copied directly to avoid the memcpy calls.
+ */
 size_t buffer_enqueue(struct circularBuffer * buffer, uint8_t * elements, size_t count) {
-	size_t i;
-	for (i = 0; i < count && remainingCapacity(buffer) > 0; i++) {
-		buffer->mem[buffer->back] = elements[i];
-		buffer->back = (buffer->back + 1) % buffer->arraySize;
+	count = makeRoom(buffer, count, buffer->policy == BUFFER_POLICY_REJECT_NEW);
+	size_t back = buffer->back;
+	if (count == 1) {
+		buffer->mem[back] = *elements;
+	} else {
+		copyIn(buffer, back, elements, count);
+	}
+	
+	// publish the elements to the consumer
+	back = wrapIndex(buffer, back + count);
+	__atomic_store_n(&buffer->back, back, __ATOMIC_RELEASE);
+	updatePeak(buffer, back);
+	return count;
+}
+
+size_t buffer_enqueuev(struct circularBuffer * buffer, const struct buffer_segment * segments, size_t count) {
+	size_t total = 0;
+	for (size_t i = 0; i < count; i++) {
+		total += segments[i].size;
+	}
+	if (makeRoom(buffer, total, false) != total) {
+		return 0;
+	}
+	
+	size_t back = buffer->back;
+	for (size_t i = 0; i < count; i++) {
+		copyIn(buffer, back, segments[i].data, segments[i].size);
+		back = wrapIndex(buffer, back + segments[i].size);
 	}
 	
-	return i;
+	// publish all the segments at once
+	__atomic_store_n(&buffer->back, back, __ATOMIC_RELEASE);
+	updatePeak(buffer, back);
+	return total;
 }
 
 size_t buffer_dequeue(struct circularBuffer * buffer, uint8_t * out, size_t count) {
-	size_t i;
-	for (i = 0; i < count && buffer_size(buffer) > 0; i++) {
-		out[i] = buffer->mem[buffer->front];
-		buffer->front = (buffer->front + 1) % buffer->arraySize;
+	if (!consumerClaim(buffer)) {
+		return 0;
+	}
+	
+	// the producer publishes the elements before back with a release store
+	size_t back = __atomic_load_n(&buffer->back, __ATOMIC_ACQUIRE);
+	size_t front = buffer->front;
+	size_t size = buffer_countBetween(buffer, front, back);
+	if (count > size) {
+		count = size;
+	}
+	if (count == 1) {
+		*out = buffer->mem[front];
+	} else {
+		copyOut(buffer, front, out, count);
+	}
+	
+	// give the space back to the producer once the elements are read
+	front = wrapIndex(buffer, front + count);
+	buffer->peekEnd = front;
+	__atomic_store_n(&buffer->front, front, __ATOMIC_RELEASE);
+	consumerRelease(buffer);
+	return count;
+}
+
+size_t buffer_peek(struct circularBuffer * buffer, uint8_t * out, size_t count) {
+	if (!consumerClaim(buffer)) {
+		return 0;
+	}
+	
+	size_t back = __atomic_load_n(&buffer->back, __ATOMIC_ACQUIRE);
+	size_t front = buffer->front;
+	size_t size = buffer_countBetween(buffer, front, back);
+	if (count > size) {
+		count = size;
 	}
-	return i;
+	
+	copyOut(buffer, front, out, count);
+	consumerRelease(buffer);
+	return count;
 }
 
 size_t buffer_peekLinear(struct circularBuffer * buffer, uint8_t ** startOut) {
-	*startOut = buffer->mem + buffer->front;
+	return buffer_peekLinearUpTo(buffer, startOut, SIZE_MAX);
+}
+
+size_t buffer_peekLinearUpTo(struct circularBuffer * buffer, uint8_t ** startOut, size_t maxCount) {
+	size_t front = buffer->front;
+	*startOut = buffer->mem + front;
+	if (!consumerClaim(buffer)) {
+		buffer->peekLinearSize = 0;
+		return 0;
+	}
+	
+	size_t back = __atomic_load_n(&buffer->back, __ATOMIC_ACQUIRE);
 	size_t size;
 	// Always count data in non circular fashion, if wrapped around only count front to arrayEnd
-	if (buffer->front <= buffer->back) {
-		size = buffer_size(buffer);
+	if (front <= back) {
+		size = back - front;
 	} else {
-		size = buffer->arraySize - buffer->front;
+		size = buffer->arraySize - front;
+	}
+	if (size > maxCount) {
+		size = maxCount;
 	}
 	
 	buffer->peekLinearSize = size;
-	return buffer->peekLinearSize;
+	__atomic_store_n(&buffer->peekEnd, wrapIndex(buffer, front + size), __ATOMIC_RELAXED);
+	consumerRelease(buffer);
+	return size;
 }
 
 void buffer_advanceLinear(struct circularBuffer * buffer) {
-	buffer->front = (buffer->front + buffer_peekSize(buffer)) % buffer->arraySize;
 	buffer->peekLinearSize = 0;
+	__atomic_store_n(&buffer->front, buffer->peekEnd, __ATOMIC_RELEASE);
+}
+
+size_t buffer_commitIndex(struct circularBuffer * buffer, size_t back) {
+	size_t count = buffer_countBetween(buffer, buffer->back, back);
+	
+	// publish the elements to the consumer
+	__atomic_store_n(&buffer->back, back, __ATOMIC_RELEASE);
+	updatePeak(buffer, back);
+	return count;
 }
@@ -9,17 +9,25 @@
  * 
  * For command usage see their associated functions.
  * To add a command see commandTable[] variable.
+ * 
+ * The parser runs on the receive event of the UART, when a burst of data ends, and on a slow poll in 
+ * case the event was dropped. A command split in several bursts is kept until its arguments arrive.
  */
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
 
 #include "commands.h"
 #include "logging.h"
+#include "sysTimer.h"
 
 #define COMMAND_SIZE 2
 #define MAX_ARG_SIZE 16
 #define BUFFER_LENGTH COMMAND_SIZE + MAX_ARG_SIZE + 1
+#define POLL_PERIOD 250 // ms, the commands are normally read on the UART receive event
 
 struct commandEntry {
 	char command[COMMAND_SIZE + 1];
@@ -30,14 +38,28 @@ struct commandEntry {
 /* Functions for the commandTable */
 static void logFilter(uint8_t * args, size_t size);
 static void logVerbosity(uint8_t * args, size_t size);
+static void logTimestamp(uint8_t * args, size_t size);
+static void idleStats(uint8_t * args, size_t size);
+static void uartStats(uint8_t * args, size_t size);
+static void uartFlowStats(uint8_t * args, size_t size);
+#ifdef UART_IRQ_PROFILING
+static void uartIrqStats(uint8_t * args, size_t size);
+#endif
+#ifdef SCHEDULER_PROFILING
+static void schedulerStats(uint8_t * args, size_t size);
+static void sendNextStatsLine(uint32_t event, void * arg);
+#endif
 
 static void nextCommands(uint32_t event, void * arg);
+static bool parseNextCommand(void);
 static struct commandEntry * findCommandEntry(uint8_t * cmd);
 
 
 static struct task * nextCommandTask; 
 static McuDevice_UART inputUART;
 static uint8_t buffer[BUFFER_LENGTH];
+static bool commandStarted = false; // a '#' was read
+static struct commandEntry * pendingEntry = NULL; // waiting for its arguments
 
 /**
  * Command table that is searched by the module.
@@ -53,42 +75,74 @@ static uint8_t buffer[BUFFER_LENGTH];
 static struct commandEntry commandTable[] = {
 	{"LF", logFilter, 5}, // logging filter module
 	{"LV", logVerbosity, 1}, // logging change verbosity
+	{"LT", logTimestamp, 1}, // logging timestamp on/off
+	{"SI", idleStats, 0}, // scheduler idle time and CPU load
+	{"UB", uartStats, 0}, // uart transmit buffer drops and peak
+	{"UF", uartFlowStats, 0}, // uart CTS flow control stalls
+#ifdef UART_IRQ_PROFILING
+	{"UI", uartIrqStats, 0}, // uart interrupt handler cycles
+#endif
+#ifdef SCHEDULER_PROFILING
+	{"ST", schedulerStats, 0}, // dump the scheduler task statistics
+#endif
 };
 
 void commands_init(McuDevice_UART UARTx) {
-	nextCommandTask = createTask(nextCommands, 0, NULL, 20, true, 2);
+	nextCommandTask = createTask(nextCommands, 0, NULL, POLL_PERIOD, true, TASK_PRIORITY_COMMANDS);
 	inputUART = UARTx;
+	uart_setRxEvent(UARTx, nextCommands, NULL, TASK_PRIORITY_COMMANDS);
 }
 //~ void commands_close();
 
 static void nextCommands(uint32_t event, void * arg) {
-	uint8_t * cursor = buffer;
-	// find if there's a command start (#)
-	do {
-		if (uart_read(inputUART, cursor, 1) == 0) {
-			return;
-		}
-	} while (*cursor != '#');
-	
-	// find command and its entry
-	if (uart_read(inputUART, cursor, COMMAND_SIZE) != COMMAND_SIZE) {
-		return;
+	while (parseNextCommand()) {
+	}
+}
+
+/*
+ * Parse and run the next command.
+ * 
+ * Returns false when the received data is exhausted, the command started is kept for the next call.
+ */
+static bool parseNextCommand(void) {
+	if (!commandStarted) {
+		// find if there's a command start (#)
+		do {
+			if (uart_read(inputUART, buffer, 1) == 0) {
+				return false;
+			}
+		} while (*buffer != '#');
+		commandStarted = true;
 	}
 	
-	struct commandEntry * entry = findCommandEntry(cursor);
-	
-	if (entry == NULL) {
-		return;
+	// find command and its entry
+	if (pendingEntry == NULL) {
+		if (uart_available(inputUART) < COMMAND_SIZE) {
+			return false;
+		}
+		uart_read(inputUART, buffer, COMMAND_SIZE);
+		pendingEntry = findCommandEntry(buffer);
+		if (pendingEntry == NULL) {
+			commandStarted = false;
+			return true;
+		}
 	}
 	
 	// Error if argSize of entry is too large
-	if (entry->argSize > MAX_ARG_SIZE) {
-		entry->argSize = MAX_ARG_SIZE;
+	if (pendingEntry->argSize > MAX_ARG_SIZE) {
+		pendingEntry->argSize = MAX_ARG_SIZE;
+	}
+	if (uart_available(inputUART) < pendingEntry->argSize) {
+		return false;
 	}
 	
-	size_t argReadSize = uart_read(inputUART, cursor, entry->argSize);
+	struct commandEntry * entry = pendingEntry;
+	pendingEntry = NULL;
+	commandStarted = false;
+	size_t argReadSize = uart_read(inputUART, buffer, entry->argSize);
 	buffer[argReadSize] = '\0'; // make it a null terminated string
-	(entry->vector)(cursor, argReadSize);
+	(entry->vector)(buffer, argReadSize);
+	return true;
 }
 
 static struct commandEntry * findCommandEntry(uint8_t * cmd) {
@@ -135,3 +189,218 @@ static void logFilter(uint8_t * args, size_t size) {
 static void logVerbosity(uint8_t * args, size_t size) {
 	logging_setVerbosity(*args);
 }
+
+/**
+ * @brief Turn on/off the us timestamp of the logging messages.
+ * 
+ * Usage: #LT<on>
+ * 		on: '1' to add the timestamp, anything else to remove it.
+ * 		  eg.: #LT1
+ */
+static void logTimestamp(uint8_t * args, size_t size) {
+	logging_setTimestamp(*args == '1');
+}
+
+/**
+ * @brief Send the scheduler idle statistics to the command UART and start a new window.
+ * 
+ * Usage: #SI
+ * 		SI <idle us> <elapsed ms> <load %> <sleep count>
+ * 		The load is the percentage of the elapsed time the core was awake.
+ * 
+ * @see scheduler_getIdleStats
+ */
+static void idleStats(uint8_t * args, size_t size) {
+	char line[64];
+	struct scheduler_idleStats stats;
+	
+	scheduler_getIdleStats(&stats);
+	uint32_t elapsedMs = sysTimer_GetTick() - stats.sinceTick;
+	uint64_t idlePercent = (elapsedMs > 0) ? stats.idleMicros / ((uint64_t) elapsedMs * 10) : 100;
+	uint32_t load = (idlePercent < 100) ? 100 - (uint32_t) idlePercent : 0;
+	
+	int length = snprintf(line, sizeof(line), "SI %" PRIu64 " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+			stats.idleMicros, elapsedMs, load, stats.sleepCount);
+	uart_write(inputUART, (uint8_t *) line, length);
+	scheduler_resetIdleStats();
+}
+
+/**
+ * @brief Send the transmit lane counters of the PC and XBee UARTs to the command UART and clear them.
+ * 
+ * Usage: #UB
+ * 		One line is sent per UART and lane:
+ * 		UB <uart> <lane> <dropped bytes> <dropped writes> <peak bytes> <capacity bytes>
+ * 		The lane is U for urgent and B for bulk.
+ * 		Then one line per UART with the receptions that may have lost data since the start:
+ * 		UB <uart> R <overruns>
+ * 
+ * @see uart_getTxStats
+ * @see uart_getRxOverrunCount
+ */
+static void uartStats(uint8_t * args, size_t size) {
+	char line[64];
+	struct buffer_stats stats[2][2];
+	McuDevice_UART devices[2] = {mcuDevice_serialPC, mcuDevice_serialXBee};
+	const char * names[2] = {"PC", "XBEE"};
+	const char laneNames[2] = {'U', 'B'};
+	const enum uart_lane lanes[2] = {UART_LANE_URGENT, UART_LANE_BULK};
+	
+	// read all the counters first, the lines sent below count in the command UART peak
+	for (int i = 0; i < 2; i++) {
+		uart_getTxStats(devices[i], lanes[0], &stats[i][0]);
+		uart_getTxStats(devices[i], lanes[1], &stats[i][1]);
+		uart_resetTxStats(devices[i]);
+	}
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			int length = snprintf(line, sizeof(line), "UB %s %c %" PRIu32 " %" PRIu32 " %u %u\n", names[i],
+					laneNames[j], stats[i][j].droppedBytes, stats[i][j].droppedWrites, 
+					(unsigned int) stats[i][j].peakSize, (unsigned int) uart_txCapacity(devices[i], lanes[j]));
+			uart_write(inputUART, (uint8_t *) line, length);
+		}
+	}
+	for (int i = 0; i < 2; i++) {
+		int length = snprintf(line, sizeof(line), "UB %s R %" PRIu32 "\n", names[i], 
+				uart_getRxOverrunCount(devices[i]));
+		uart_write(inputUART, (uint8_t *) line, length);
+	}
+}
+
+/**
+ * @brief Send the CTS stall counters of the UARTs with flow control to the command UART and clear them.
+ * 
+ * Usage: #UF
+ * 		One line is sent per UART with CTS flow control:
+ * 		UF <uart> <stalls> <total stall us> <max stall us> <stalled now 0|1>
+ * 
+ * @see uart_getFlowStats
+ */
+static void uartFlowStats(uint8_t * args, size_t size) {
+	char line[64];
+	struct uart_flowStats stats;
+	McuDevice_UART devices[2] = {mcuDevice_serialPC, mcuDevice_serialXBee};
+	const char * names[2] = {"PC", "XBEE"};
+	
+	for (int i = 0; i < 2; i++) {
+		if (!uart_getFlowStats(devices[i], &stats)) {
+			continue;
+		}
+		uart_resetFlowStats(devices[i]);
+		int length = snprintf(line, sizeof(line), "UF %s %" PRIu32 " %" PRIu64 " %" PRIu32 " %d\n", names[i],
+				stats.stallCount, stats.stallMicrosTotal, stats.stallMicrosMax, stats.stalled ? 1 : 0);
+		uart_write(inputUART, (uint8_t *) line, length);
+	}
+}
+
+#ifdef UART_IRQ_PROFILING
+/**
+ * @brief Send the interrupt handler cycles of the PC and XBee UARTs to the command UART and clear them.
+ * 
+ * Usage: #UI
+ * 		One line is sent per UART:
+ * 		UI <uart> <irq count> <bytes> <max cycles> <mean cycles per irq> <cycles per byte>
+ * 		The USART and its DMA channels handlers are counted together.
+ * 
+ * @see uart_getIrqStats
+ */
+static void uartIrqStats(uint8_t * args, size_t size) {
+	char line[80];
+	struct uart_irqStats stats[2];
+	McuDevice_UART devices[2] = {mcuDevice_serialPC, mcuDevice_serialXBee};
+	const char * names[2] = {"PC", "XBEE"};
+	
+	// read all the counters first, the lines sent below are counted in the command UART
+	for (int i = 0; i < 2; i++) {
+		uart_getIrqStats(devices[i], &stats[i]);
+		uart_resetIrqStats(devices[i]);
+	}
+	for (int i = 0; i < 2; i++) {
+		uint32_t perIrq = (stats[i].count > 0) ? (uint32_t) (stats[i].cyclesTotal / stats[i].count) : 0;
+		uint32_t perByte = (stats[i].bytes > 0) ? (uint32_t) (stats[i].cyclesTotal / stats[i].bytes) : 0;
+		int length = snprintf(line, sizeof(line), "UI %s %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+				names[i], stats[i].count, stats[i].bytes, stats[i].cyclesMax, perIrq, perByte);
+		uart_write(inputUART, (uint8_t *) line, length);
+	}
+}
+#endif /* UART_IRQ_PROFILING */
+
+#ifdef SCHEDULER_PROFILING
+
+#define STATS_LINE_SIZE 128
+// ms to send a full line on the command UART, 10 bits per character
+#define STATS_LINE_INTERVAL ((STATS_LINE_SIZE * 10 * 1000) / SERIALPC_CONF_BAUDRATE + 1)
+
+static struct task * statsTask = NULL;
+static size_t statsNextSlot = 0;
+static bool statsHeaderSent = false;
+static char statsLine[STATS_LINE_SIZE];
+
+/**
+ * @brief Dump the scheduler profiling table to the command UART.
+ * 
+ * Usage: #ST
+ * 		One line is sent per task: 
+ * 		<slot> <vector> <run count> <min cycles> <max cycles> <mean cycles> <min latency> <max latency> <overruns>
+ * 		The latencies are in us after the task was due.
+ * 
+ * The table is sent on the bulk lane of the UART, it doesn't delay the urgent writes. One line is 
+ * written every STATS_LINE_INTERVAL, the time the UART takes to send it, so the dump doesn't keep the 
+ * scheduler busy. A line is only written when the whole line fits in the lane, else the same line is 
+ * tried again on the next interval.
+ * 
+ * @see scheduler_getTaskStats
+ */
+static void schedulerStats(uint8_t * args, size_t size) {
+	if (statsTask != NULL) {
+		return;
+	}
+	
+	statsHeaderSent = false;
+	statsNextSlot = 0;
+	statsTask = createTask(sendNextStatsLine, 0, NULL, STATS_LINE_INTERVAL, true, TASK_PRIORITY_COMMANDS);
+}
+
+static void sendNextStatsLine(uint32_t event, void * arg) {
+	struct scheduler_taskStats stats;
+	size_t slot = statsNextSlot;
+	int length;
+	
+	if (!statsHeaderSent) {
+		length = snprintf(statsLine, STATS_LINE_SIZE, "ST slot vector runs min max mean latMin latMax overruns\n");
+	} else {
+		// skip the empty slots
+		while (slot < TASKS_MAX_COUNT && !scheduler_getTaskStats(slot, &stats)) {
+			slot++;
+		}
+		
+		if (slot >= TASKS_MAX_COUNT) {
+			destroyTask(statsTask);
+			statsTask = NULL;
+			return;
+		}
+		
+		uint32_t mean = (stats.runCount > 0) ? (uint32_t) (stats.runCyclesTotal / stats.runCount) : 0;
+		if (stats.runCount == 0) {
+			stats.runCyclesMin = 0;
+			stats.startLatencyMin = 0;
+		}
+		length = snprintf(statsLine, STATS_LINE_SIZE, 
+				"ST %u %p %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+				(unsigned int) slot, (void *) stats.vector, stats.runCount, stats.runCyclesMin, 
+				stats.runCyclesMax, mean, stats.startLatencyMin, stats.startLatencyMax, stats.overrunCount);
+	}
+	
+	// wait for the UART to drain rather than cut the line, a slot that empties meanwhile is skipped
+	if (length <= 0 || uart_txFree(inputUART, UART_LANE_BULK) < (size_t) length) {
+		return;
+	}
+	uart_writeBulk(inputUART, (uint8_t *) statsLine, length);
+	if (!statsHeaderSent) {
+		statsHeaderSent = true;
+	} else {
+		statsNextSlot = slot + 1;
+	}
+}
+
+#endif /* SCHEDULER_PROFILING */
@@ -8,15 +8,23 @@
  * are stored in a provided buffer. The number of characters written is
  * returned. Note that a null character is *not* written.
  *
- * read_telem_data: Reads the data from the acquisition buffers and stores them
- * in a global packet buffer.
+ * read_telem_segments: Reads the acquisition buffers in place and sets the
+ * segments of the packet: the time, the data of each buffer and the
+ * separators. Returns the count of segments.
  *
- * send_telem_xbee: Sends the data in the global packet buffer to the xbee.
- * Returns DRIVER_STATUS_OK if the write was successful, DRIVER_STATUS_FAILURE
- * otherwise.
+ * send_telem_xbee: Sends the packet segments to the xbee as one frame, it is
+ * either fully queued or rejected. Returns DRIVER_STATUS_OK if the write was
+ * successful, DRIVER_STATUS_ERROR otherwise.
+ *
+ * send_accel_samples: Sends the queued accelerometer samples on the bulk lane
+ * of the xbee, one line per sample: A,<sample time in us>,<x>#<y>#<z>. It
+ * sends what fits in the lane, the rest waits in the driver queue which drops
+ * the oldest when full. The xbee can't carry the full 400 Hz, the bulk lane
+ * takes the bandwidth left by the packets.
  *
  * read_and_send_telem: Reads the acquisition buffers and sends their data to
- * the xbee. Function signature matches that expected by the scheduler.
+ * the xbee, then the accelerometer samples. Function signature matches that
+ * expected by the scheduler.
  */
 
 #include <stdbool.h>
@@ -26,77 +34,108 @@
 #include "main.h"
 #include "acquisitionBuffers.h"
 #include "dataGatherer.h"
+#include "LSM303DLHC.h"
 #include "logging.h"
 #include "sysTimer.h"
 #include "xbee.h"
 
-#define TELEM_PACKET_BUFF_CAPACITY                                                 \
-	(ACQBUFF_TIMESTAMP_BUFF_CAPACITY + ACQBUFF_PITOT_BUFF_CAPACITY +           \
-	 ACQBUFF_BAROMETER_BUFF_CAPACITY + ACQBUFF_GPSALTITUDE_BUFF_CAPACITY +     \
-	 ACQBUFF_GPSPOSITION_BUFF_CAPACITY + ACQBUFF_ACCELEROMETER_BUFF_CAPACITY + \
-	 ACQBUFF_GYROSCOPE_BUFF_CAPACITY)
+#define TELEM_BUFFER_COUNT 6
+// the time and the newline, then a comma and the data of each buffer
+#define TELEM_SEGMENT_COUNT (2 + 2 * TELEM_BUFFER_COUNT)
 #define DATA_GATHERER_TIME_INTERVAL 50
-#define DATA_GATHERER_PRIORITY 1
+#define DATA_GATHERER_PRIORITY TASK_PRIORITY_TELEMETRY
+// "A,", the time, a comma, the sample and the newline
+#define ACCEL_LINE_SIZE (2 + 10 + 1 + LSM303DLHC_SAMPLE_TEXT_SIZE + 1)
 
-static size_t  telem_packet_buff_size;
-static uint8_t telem_packet_buff[TELEM_PACKET_BUFF_CAPACITY];
+static const uint8_t comma = ',';
+static const uint8_t newline = '\n';
 
-static void read_telem_data(void);
+static size_t read_telem_segments(struct buffer_segment* segments,
+                                  uint8_t* time);
 static int  send_telem_xbee(void);
+static void send_accel_samples(void);
 static void read_and_send_telem(uint32_t, void*);
 
 void data_gatherer_init(void);
 
-static void read_telem_data(void) {
-	const AcqBuff_Buffer buffers[] = {acqbuff_Pitot,
-	                                  acqbuff_Barometer,
-	                                  acqbuff_GPSAltitude,
-	                                  acqbuff_GPSPosition,
-	                                  acqbuff_Accelerometer,
-	                                  acqbuff_Gyroscope};
-	uint8_t* end = telem_packet_buff; // Points past the last filled
-	                                  // element of the buffer.
+static size_t read_telem_segments(struct buffer_segment* segments,
+                                  uint8_t* time) {
+	const AcqBuff_Buffer buffers[TELEM_BUFFER_COUNT] = {acqbuff_Pitot,
+	                                                    acqbuff_Barometer,
+	                                                    acqbuff_GPSAltitude,
+	                                                    acqbuff_GPSPosition,
+	                                                    acqbuff_Accelerometer,
+	                                                    acqbuff_Gyroscope};
+	struct buffer_segment* end = segments; // Points past the last set
+	                                       // segment.
 
 	// Add msTick.
-	const uint32_t time = sysTimer_GetTick();
-	end += ui2ascii(time, end);
-	*end++ = ',';
-
-	// Iterate over all acquisition buffers and read them into the
-	// telemetry packet buffer, separating the contents of each buffer with
-	// a comma.
-	for (size_t i = 0; i < sizeof(buffers) / sizeof(AcqBuff_Buffer); ++i) {
-		end += acqBuff_read(buffers[i], end);
-		*end++ = ',';
+	end->data = time;
+	end->size = ui2ascii(sysTimer_GetTick(), time);
+	end++;
+
+	// Point to the data of every acquisition buffer, separating each
+	// buffer with a comma. The data stays in place until it is copied by
+	// the xbee write.
+	for (size_t i = 0; i < TELEM_BUFFER_COUNT; ++i) {
+		end->data = &comma;
+		end->size = 1;
+		end++;
+		end->size = acqBuff_readRef(buffers[i], &end->data);
+		end++;
 	}
 
-	// Replace the trailing comma with a newline.
-	*(end - 1) = '\n';
+	// Terminate the packet with a newline.
+	end->data = &newline;
+	end->size = 1;
+	end++;
 
-	telem_packet_buff_size = end - telem_packet_buff;
+	return end - segments;
 }
 
 static int send_telem_xbee(void) {
-	return xbee_write(telem_packet_buff, telem_packet_buff_size);
+	struct buffer_segment segments[TELEM_SEGMENT_COUNT];
+	uint8_t time[ACQBUFF_TIMESTAMP_BUFF_CAPACITY];
+
+	return xbee_writev(segments, read_telem_segments(segments, time));
+}
+
+static void send_accel_samples(void) {
+	struct lsm303dlhc_sample sample;
+	uint8_t line[ACCEL_LINE_SIZE];
+
+	while (xbee_bulkFree() >= ACCEL_LINE_SIZE
+	       && lsm303dlhc_readSamples(&sample, 1) == 1) {
+		size_t size = 0;
+		line[size++] = 'A';
+		line[size++] = ',';
+		size += ui2ascii(sample.timestamp, line + size);
+		line[size++] = ',';
+		size += lsm303dlhc_formatSample(&sample, line + size);
+		line[size++] = '\n';
+		xbee_writeBulk(line, size);
+	}
 }
 
 static void read_and_send_telem(uint32_t event, void* arg) {
 	UNUSED(arg);
 	UNUSED(event);
 		
-	read_telem_data();
 	if (send_telem_xbee() == DRIVER_STATUS_ERROR) {
 		logging_send("Could not send telemetry data to xbee.",
 		             MODULE_INDEX_DATA_GATHERER,
 		             LOG_CRITICAL);
 	}
+	send_accel_samples();
 }
 
 void data_gatherer_init(void) {
-	createTask(read_and_send_telem,
-	           0,
-	           NULL,
-	           DATA_GATHERER_TIME_INTERVAL,
-	           true,
-	           DATA_GATHERER_PRIORITY);
+	struct task* task = createTask(read_and_send_telem,
+	                               0,
+	                               NULL,
+	                               DATA_GATHERER_TIME_INTERVAL,
+	                               true,
+	                               DATA_GATHERER_PRIORITY);
+	// Fixed packet rate, independent of the time taken to build it.
+	scheduler_setPeriodMode(task, SCHEDULER_PERIOD_DEADLINE_SKIP);
 }
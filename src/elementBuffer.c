@@ -0,0 +1,51 @@
+/**
+ * @file elementBuffer.c
+ * @author Space Concordia Rocket Division
+ * @brief Fifo circular queue of fixed size elements, eg. binary sensor samples.
+ *
+ * The counts are rounded down to whole elements before calling the circularBuffer, the free space
+ * only grows for the producer and the used space only grows for the consumer, so the byte count
+ * asked is always moved entirely and the buffer never holds a partial element.
+ */
+
+#include "elementBuffer.h"
+
+int elementBuffer_attachArray(struct elementBuffer * buffer, uint8_t * arrayStart, size_t arraySize,
+		size_t elementSize) {
+	if (buffer == NULL || elementSize == 0 || arraySize <= elementSize) {
+		return BUFFER_STATUS_ERROR;
+	}
+
+	buffer->elementSize = elementSize;
+	return buffer_attachArray(&buffer->bytes, arrayStart, arraySize);
+}
+
+size_t elementBuffer_push(struct elementBuffer * buffer, const void * elements, size_t count) {
+	size_t freeCount = elementBuffer_capacity(buffer) - elementBuffer_count(buffer);
+	if (count > freeCount) {
+		count = freeCount;
+	}
+
+	buffer_enqueue(&buffer->bytes, (uint8_t *) elements, count * buffer->elementSize);
+	return count;
+}
+
+size_t elementBuffer_pop(struct elementBuffer * buffer, void * out, size_t count) {
+	size_t usedCount = elementBuffer_count(buffer);
+	if (count > usedCount) {
+		count = usedCount;
+	}
+
+	buffer_dequeue(&buffer->bytes, out, count * buffer->elementSize);
+	return count;
+}
+
+size_t elementBuffer_peek(struct elementBuffer * buffer, void * out, size_t count) {
+	size_t usedCount = elementBuffer_count(buffer);
+	if (count > usedCount) {
+		count = usedCount;
+	}
+
+	buffer_peek(&buffer->bytes, out, count * buffer->elementSize);
+	return count;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file exti.c
+ * @author Space Concordia Rocket Division
+ * @brief External interrupt lines that post a timestamped scheduler event, eg. a sensor data ready pin.
+ *
+ * The hal configures the pin, the AFIO port selection and the edge registers with HAL_GPIO_Init().
+ * The handlers clear the pending bits of their lines and post the events, the lines 5 to 9 and 10 to 15
+ * share an interrupt. The vector of a line is written last when it is opened, like uart_setRxEvent().
+ */
+
+#include <stddef.h>
+
+#include "exti.h"
+#include "main.h"
+#include "scheduler.h"
+#include "sysTimer.h"
+
+#define EXTI_PRIORITY 0
+
+struct exti_line {
+	void (*vector)(uint32_t, void *);
+	void * argument;
+	uint8_t priority;
+	uint32_t droppedCount;
+};
+
+static struct exti_line lines[EXTI_LINES_COUNT];
+
+static GPIO_TypeDef * const ports[] = {GPIOA, GPIOB, GPIOC, GPIOD};
+
+static void enablePortClock(enum exti_port port);
+static IRQn_Type lineIrq(uint8_t line);
+static void dispatch(uint8_t first, uint8_t last);
+
+bool exti_open(enum exti_port port, uint8_t line, enum exti_edge edge, void (*vector)(uint32_t, void *),
+		void * argument, uint8_t priority) {
+	if (line >= EXTI_LINES_COUNT || port > EXTI_PORT_D || vector == NULL) {
+		return false;
+	}
+
+	struct exti_line * extiLine = &lines[line];
+	__atomic_store_n(&extiLine->vector, NULL, __ATOMIC_RELAXED);
+	extiLine->argument = argument;
+	extiLine->priority = priority;
+	extiLine->droppedCount = 0;
+	__atomic_store_n(&extiLine->vector, vector, __ATOMIC_RELEASE);
+
+	enablePortClock(port);
+	GPIO_InitTypeDef gpioInit = {0};
+	gpioInit.Pin = (uint16_t) (1u << line);
+	if (edge == EXTI_EDGE_RISING) {
+		gpioInit.Mode = GPIO_MODE_IT_RISING;
+	} else if (edge == EXTI_EDGE_FALLING) {
+		gpioInit.Mode = GPIO_MODE_IT_FALLING;
+	} else {
+		gpioInit.Mode = GPIO_MODE_IT_RISING_FALLING;
+	}
+	gpioInit.Pull = GPIO_NOPULL;
+	HAL_GPIO_Init(ports[port], &gpioInit);
+
+	__HAL_GPIO_EXTI_CLEAR_IT(gpioInit.Pin);
+	HAL_NVIC_SetPriority(lineIrq(line), EXTI_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(lineIrq(line));
+	return true;
+}
+
+void exti_close(uint8_t line) {
+	if (line >= EXTI_LINES_COUNT) {
+		return;
+	}
+
+	// the shared interrupts stay enabled for the other lines
+	CLEAR_BIT(EXTI->IMR, 1u << line);
+	__atomic_store_n(&lines[line].vector, NULL, __ATOMIC_RELAXED);
+}
+
+uint32_t exti_getDroppedCount(uint8_t line) {
+	return (line < EXTI_LINES_COUNT) ? lines[line].droppedCount : 0;
+}
+
+static void enablePortClock(enum exti_port port) {
+	switch (port) {
+	case EXTI_PORT_A:
+		__HAL_RCC_GPIOA_CLK_ENABLE();
+		break;
+	case EXTI_PORT_B:
+		__HAL_RCC_GPIOB_CLK_ENABLE();
+		break;
+	case EXTI_PORT_C:
+		__HAL_RCC_GPIOC_CLK_ENABLE();
+		break;
+	case EXTI_PORT_D:
+		__HAL_RCC_GPIOD_CLK_ENABLE();
+		break;
+	}
+}
+
+static IRQn_Type lineIrq(uint8_t line) {
+	static const IRQn_Type lowLines[] = {EXTI0_IRQn, EXTI1_IRQn, EXTI2_IRQn, EXTI3_IRQn, EXTI4_IRQn};
+	if (line < LENGTH_OF_ARRAY(lowLines)) {
+		return lowLines[line];
+	}
+	return (line < 10) ? EXTI9_5_IRQn : EXTI15_10_IRQn;
+}
+
+/*
+ * The time is read before anything else, then the pending bits of the lines are cleared by writing 1.
+ * An edge that comes after the clear pends the interrupt again.
+ */
+static void dispatch(uint8_t first, uint8_t last) {
+	uint32_t micros = sysTimer_GetMicros();
+	uint32_t mask = ((1u << (last + 1)) - 1) & ~((1u << first) - 1);
+	uint32_t pending = EXTI->PR & mask;
+	EXTI->PR = pending;
+
+	for (uint8_t line = first; line <= last; line++) {
+		if (!(pending & (1u << line))) {
+			continue;
+		}
+		struct exti_line * extiLine = &lines[line];
+		void (*vector)(uint32_t, void *) = __atomic_load_n(&extiLine->vector, __ATOMIC_ACQUIRE);
+		if (vector != NULL && !scheduler_postEvent(vector, micros, extiLine->argument, extiLine->priority)) {
+			extiLine->droppedCount++;
+		}
+	}
+}
+
+void EXTI0_IRQHandler(void) {
+	dispatch(0, 0);
+}
+
+void EXTI1_IRQHandler(void) {
+	dispatch(1, 1);
+}
+
+void EXTI2_IRQHandler(void) {
+	dispatch(2, 2);
+}
+
+void EXTI3_IRQHandler(void) {
+	dispatch(3, 3);
+}
+
+void EXTI4_IRQHandler(void) {
+	dispatch(4, 4);
+}
+
+void EXTI9_5_IRQHandler(void) {
+	dispatch(5, 9);
+}
+
+void EXTI15_10_IRQHandler(void) {
+	dispatch(10, 15);
+}
@@ -4,13 +4,26 @@
  * @author Mathieu Breault
  * @brief Interrupt or DMA based i2c device driver.
  * 
+ * The queued jobs of a bus are kept in an elementBuffer, the main loop is the producer and the consumer.
+ * startNext() is called from i2c_submit() when the bus is idle. The completion interrupt of a job only
+ * posts its callback, clears busy and posts startQueued() if more jobs are waiting, the next job is 
+ * started from the main loop. The hal starts a transfer by polling the bus with HAL_GetTick() timeouts,
+ * they never expire in an interrupt of a higher priority than SysTick, and the polling would delay the
+ * USART and DMA interrupts.
+ * 
+ * The transfers use the interrupt mode of the hal. The I2C DMA channels are the ones of the USART 
+ * receive DMA (I2C2_RX on channel 5 with USART1_RX, I2C1_RX on channel 7 with USART2_TX). This hal 
+ * version also sends the slave and register address by polling in HAL_I2C_Mem_Read_IT(), a few bytes 
+ * of bus time, only the data phase is interrupt driven.
  */
 
 #include <stddef.h>
 #include "i2c.h"
 #include "stm32f1xx_hal.h"
 #include "circularBuffer.h"
+#include "elementBuffer.h"
 #include "scheduler.h"
+#include "main.h"
 
 #define DEFAULT_CLOCKSPEED 400000
 #define DEFAULT_DUTYCYCLE I2C_DUTYCYCLE_2
@@ -23,12 +36,17 @@
 
 #define BLOCKING_TIMEOUT_MS 500
 
+#define JOBS_MAX_COUNT 8
+#define START_PRIORITY 0 // the bus stays idle until startQueued() runs
 
 // Internal peripheral structure, hi2c Handle should be first to make
 // casting possible between i2c_Peripheral and I2C_HandleTypeDef.
 struct i2c_Peripheral {
 	I2C_HandleTypeDef hi2c;
-	void (*callback)(uint32_t, void *);
+	struct elementBuffer jobs;
+	uint8_t jobsArray[ELEMENTBUFFER_ARRAY_SIZE(sizeof(struct i2c_job), JOBS_MAX_COUNT)];
+	struct i2c_job current;
+	bool busy; // a job is running, its completion interrupt starts the next one
 };
 
 static struct i2c_Peripheral device_i2c2 = {
@@ -45,7 +63,6 @@ static struct i2c_Peripheral device_i2c2 = {
 			.NoStretchMode = DEFAULT_NOSTRETCHMODE,
 		},
 	},
-	.callback = NULL,
 };
 
 static struct i2c_Peripheral device_i2c1 = {
@@ -62,12 +79,16 @@ static struct i2c_Peripheral device_i2c1 = {
 			.NoStretchMode = DEFAULT_NOSTRETCHMODE,
 		},
 	},
-	.callback = NULL,
 };
 
 McuDevice_I2C mcuDevice_i2cBus1 = &device_i2c1;
 McuDevice_I2C mcuDevice_i2cBus2 = &device_i2c2;
 
+static void startJobs(struct i2c_Peripheral * device);
+static void startNext(struct i2c_Peripheral * device);
+static void startQueued(uint32_t event, void * arg);
+static void finishJob(struct i2c_Peripheral * device, enum i2c_event event);
+
 
 static inline void setAddressingMode(I2C_HandleTypeDef * device, enum i2c_addressing_mode mode) {
 	if (mode == I2C_ADDRESS_10BIT) {
@@ -92,6 +113,10 @@ int i2c_open(McuDevice_I2C bus, struct i2c_busConf * conf) {
 	//~ device->hi2c.Init.ClockSpeed = conf->clockSpeed;
 	//~ setAddressingMode(&(device->hi2c), conf->addressingMode);
 	
+	elementBuffer_attachArray(&device->jobs, device->jobsArray, LENGTH_OF_ARRAY(device->jobsArray), 
+			sizeof(struct i2c_job));
+	device->busy = false;
+	
 	if (HAL_I2C_Init(&(device->hi2c)) == HAL_OK) {
 		return I2C_STATUS_OK;
 	} else {
@@ -125,22 +150,48 @@ int i2c_ioctl_setSlave(McuDevice_I2C bus, struct i2c_slaveDevice * slave,
 	return I2C_STATUS_OK;
 }
 
+int i2c_submit(const struct i2c_job * job) {
+	if (job == NULL || job->slave == NULL || job->slave->bus == NULL || job->data == NULL 
+			|| job->size == 0 || job->size > UINT16_MAX) {
+		return I2C_STATUS_ERROR;
+	}
+	struct i2c_Peripheral * device = (struct i2c_Peripheral *) job->slave->bus;
+	
+	if (elementBuffer_push(&device->jobs, job, 1) != 1) {
+		return I2C_STATUS_BUSY;
+	}
+	startJobs(device);
+	return I2C_STATUS_OK;
+}
+
 int i2c_writeRegister(struct i2c_slaveDevice * slave, uint16_t memoryAddress, 
 		enum i2c_addressSize addSize, uint8_t * data, size_t size) {
-	struct i2c_Peripheral * device = (struct i2c_Peripheral *) slave->bus;
-	
-	int status = HAL_I2C_Mem_Write_IT(&(device->hi2c), slave->address, memoryAddress, addSize, data, size);
-	return mapStatusFromHAL(status);
+	struct i2c_job job = {
+		.slave = slave,
+		.memoryAddress = memoryAddress,
+		.addSize = addSize,
+		.data = data,
+		.size = size,
+		.read = false,
+		.callback = NULL,
+	};
+	return i2c_submit(&job);
 }
 
 int i2c_readRegister(struct i2c_slaveDevice * slave, uint16_t memoryAddress, enum i2c_addressSize addSize, 
 		uint8_t * data, size_t size) {
-	struct i2c_Peripheral * device = (struct i2c_Peripheral *) slave->bus;
-
-	device->callback = slave->callback;
-	
-	int status = HAL_I2C_Mem_Read_IT(&(device->hi2c), slave->address, memoryAddress, addSize, data, size);
-	return mapStatusFromHAL(status);
+	struct i2c_job job = {
+		.slave = slave,
+		.memoryAddress = memoryAddress,
+		.addSize = addSize,
+		.data = data,
+		.size = size,
+		.read = true,
+		.callback = slave->callback,
+		.argument = NULL,
+		.priority = 0,
+	};
+	return i2c_submit(&job);
 }
 
 int i2c_writeRegister_blocking(struct i2c_slaveDevice * slave, uint16_t memoryAddress, 
@@ -154,16 +205,83 @@ int i2c_writeRegister_blocking(struct i2c_slaveDevice * slave, uint16_t memoryAd
 int i2c_readRegister_blocking(struct i2c_slaveDevice * slave, uint16_t memoryAddress, enum i2c_addressSize addSize, 
 		uint8_t * data, size_t size) {
 	struct i2c_Peripheral * device = (struct i2c_Peripheral *) slave->bus;
-
-	device->callback = slave->callback;
 	
 	int status = HAL_I2C_Mem_Read(&(device->hi2c), slave->address, memoryAddress, addSize, data, size, BLOCKING_TIMEOUT_MS);
 	return mapStatusFromHAL(status);
 }
 
+/*
+ * The fence keeps the push of the job before the read of busy: if the completion interrupt comes after 
+ * the push it sees the job and posts startQueued(), else busy is false here.
+ */
+static void startJobs(struct i2c_Peripheral * device) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&device->busy, __ATOMIC_RELAXED)) {
+		startNext(device);
+	}
+}
+
+/*
+ * Start the next queued job from the main loop, a job the hal refuses is completed with I2C_EVENT_ERROR 
+ * and the following one is tried. busy is set before the transfer starts, its completion interrupt can
+ * come before the hal returns.
+ */
+static void startNext(struct i2c_Peripheral * device) {
+	struct i2c_job * job = &device->current;
+	
+	while (elementBuffer_pop(&device->jobs, job, 1) == 1) {
+		__atomic_store_n(&device->busy, true, __ATOMIC_RELAXED);
+		
+		HAL_StatusTypeDef status;
+		if (job->read) {
+			status = HAL_I2C_Mem_Read_IT(&device->hi2c, job->slave->address, job->memoryAddress, job->addSize, 
+					job->data, (uint16_t) job->size);
+		} else {
+			status = HAL_I2C_Mem_Write_IT(&device->hi2c, job->slave->address, job->memoryAddress, job->addSize, 
+					job->data, (uint16_t) job->size);
+		}
+		if (status == HAL_OK) {
+			return;
+		}
+		if (job->callback != NULL) {
+			scheduler_postEvent(job->callback, I2C_EVENT_ERROR, job->argument, job->priority);
+		}
+	}
+	__atomic_store_n(&device->busy, false, __ATOMIC_RELAXED);
+}
+
+// posted by the completion interrupt, i2c_submit() may have started the next job before it runs
+static void startQueued(uint32_t event, void * arg) {
+	startJobs((struct i2c_Peripheral *) arg);
+}
+
+/*
+ * Completion interrupt of the current job. If the post of startQueued() is dropped the queued jobs wait
+ * for the next i2c_submit() on the bus.
+ */
+static void finishJob(struct i2c_Peripheral * device, enum i2c_event event) {
+	struct i2c_job * job = &device->current;
+	if (job->callback != NULL) {
+		scheduler_postEvent(job->callback, event, job->argument, job->priority);
+	}
+	
+	__atomic_store_n(&device->busy, false, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (elementBuffer_count(&device->jobs) > 0) {
+		scheduler_postEvent(startQueued, 0, device, START_PRIORITY);
+	}
+}
+
 void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
-	struct i2c_Peripheral * device = (struct i2c_Peripheral *) hi2c;
-	createTask(device->callback, I2C_EVENT_RX_TRANSFER_DONE, NULL,	0, false, 0);
+	finishJob((struct i2c_Peripheral *) hi2c, I2C_EVENT_RX_TRANSFER_DONE);
+}
+
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+	finishJob((struct i2c_Peripheral *) hi2c, I2C_EVENT_TX_TRANSFER_DONE);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+	finishJob((struct i2c_Peripheral *) hi2c, I2C_EVENT_ERROR);
 }
 
 void I2C1_EV_IRQHandler(void)
@@ -11,6 +11,7 @@
 #include <string.h> 
 
 #include "logging.h"
+#include "sysTimer.h"
  
 #define LOG_NONE (0x00)
 #define LOG_ALL  (0xFF)
@@ -31,6 +32,7 @@ static bool moduleFilter[LOGGING_MODULE_COUNT];
 static int logLevel = LOG_NONE;
 static bool logActive = false;
 static bool logPause = false;
+static bool logTimestamp = false;
 
 static char debugMsg[] = "DEBUG: ";
 static uint8_t debugMsgLength = LENGTH_OF_ARRAY(debugMsg) - 1;
@@ -64,6 +66,10 @@ static inline bool logEventIsActive(enum logging_level eventLevel) {
 
 static inline void writeLog(char * levelMsg, uint8_t levelMsgLength, char * msg, size_t msgLength) {
 	clearBuffer();
+	if (logTimestamp) {
+		msgBufferCount += ui2ascii(sysTimer_GetMicros(), (uint8_t *) msgBuffer);
+		addToBuffer(" ", 1);
+	}
 	addToBuffer(levelMsg, levelMsgLength);
 	addToBuffer(msg, msgLength);
 	addToBuffer("\n", 1);
@@ -173,6 +179,14 @@ int logging_filterModule(uint8_t moduleIndex, bool filterOn) {
 	return 0;
 }
 
+/*
+ * Prefix the messages with the time in us.
+ */
+int logging_setTimestamp(bool enable) {
+	logTimestamp = enable;
+	return 0;
+}
+
 int logging_setOutput(int (*write)(uint8_t * data, size_t size)) {
 	logStream = write;
 	return 0;
@@ -21,6 +21,7 @@
 #include "LSM303DLHC.h"
 #include "i2c.h"
 #include "MPL3115A2.h"
+#include "sysTimer.h"
 
 static void clockConfig(void);
 static void initBlinkGPIO(void);
@@ -38,10 +39,11 @@ int main(void) {
 	// Initialize the HAL Device Library
 	HAL_Init();
 	clockConfig();
+	sysTimer_init();
 	
 	
 	initBlinkGPIO();
-	createTask(blink, 0, NULL, 1000, true, 2);
+	createTask(blink, 0, NULL, 1000, true, TASK_PRIORITY_BLINK);
 	
 	initLoggingUART();
 	logging_open(loggingStream);
@@ -136,7 +138,11 @@ static int initLoggingUART(void) {
 		.stopbits = SERIALPC_CONF_STOPBITS,
 	};
 
-	return uart_open(mcuDevice_serialPC, &setConfig);
+	if (uart_open(mcuDevice_serialPC, &setConfig) != DRIVER_STATUS_OK) {
+		return DRIVER_STATUS_ERROR;
+	}
+	// a log line goes out whole or not at all
+	return uart_setTxPolicy(mcuDevice_serialPC, BUFFER_POLICY_DROP_RECORD, BUFFER_NO_DELIMITER);
 }
 
 static int initXbeeUART(void) {
@@ -148,6 +154,8 @@ static int initXbeeUART(void) {
 	};
 
 	uart_open(mcuDevice_serialXBee, &setConfig);
+	// the newest telemetry lines replace the oldest ones when the link falls behind
+	uart_setTxPolicy(mcuDevice_serialXBee, BUFFER_POLICY_OVERWRITE_OLDEST, '\n');
 	return xbee_open(mcuDevice_serialXBee);
 }
 
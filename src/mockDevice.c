@@ -36,7 +36,7 @@ static struct task * mockTask = NULL;
 static void loop(uint32_t event, void * args);
 
 void mockDevice_init() {
-	mockTask = createTask(loop, 0, NULL, LOOP_MS_INTERVAL, true, 2);
+	mockTask = createTask(loop, 0, NULL, LOOP_MS_INTERVAL, true, TASK_PRIORITY_MOCK_DEVICE);
 }
 
 
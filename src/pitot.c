@@ -56,7 +56,8 @@ int init_pitot(uint32_t msInterval) {
 	
 	HAL_GPIO_Init(PITOT_CS_PORT, &gpioInit);
 	
-	runTask = createTask(read_pitot, 0, NULL, msInterval, true, 1);
+	runTask = createTask(read_pitot, 0, NULL, msInterval, true, TASK_PRIORITY_PITOT);
+	scheduler_setPeriodMode(runTask, SCHEDULER_PERIOD_DEADLINE_SKIP);
 	return DRIVER_STATUS_OK;
 }
 
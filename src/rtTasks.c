@@ -0,0 +1,175 @@
+/**
+ * @file rtTasks.c
+ * @author Space Concordia Rocket Division
+ * @brief Preemptive tier for a few short fixed rate tasks, next to the cooperative scheduler.
+ *
+ * The TIM4 update interrupt counts down the period of every task and marks it pending when it reaches
+ * 0, then pends PendSV. PendSV_Handler() runs the pending tasks in runOrder, sorted by period. A task
+ * still pending or running when it is due again counts an overrun and that period is skipped.
+ * The pending and running flags are only written as whole bytes, the TIM4 interrupt can preempt PendSV
+ * but never the other way around.
+ *
+ * Only built with RT_TASKS defined, the tier takes TIM4_IRQHandler() and PendSV_Handler() over from
+ * stm32f1xx_it.c.
+ */
+
+#ifdef RT_TASKS
+
+#include <stddef.h>
+
+#include "rtTasks.h"
+#include "main.h"
+#include "sysTimer.h"
+
+#define TIMER_COUNT_FREQUENCY 1000000
+#define BASE_PERIOD_MICROS (TIMER_COUNT_FREQUENCY / RT_TASKS_BASE_FREQUENCY)
+
+struct rtTask {
+	void (*vector)(void *);
+	void * argument;
+	uint32_t periodTicks;
+	uint32_t countdown;
+	volatile bool pending;
+	volatile bool running;
+	struct rtTasks_stats stats;
+};
+
+static struct rtTask rtTasks[RT_TASKS_MAX_COUNT];
+static uint8_t runOrder[RT_TASKS_MAX_COUNT]; // index in rtTasks, shortest period first
+static size_t rtTasksCount = 0;
+static bool started = false;
+
+int rtTasks_add(void (*vector)(void *), void * argument, uint32_t periodMicros) {
+	if (started || vector == NULL || rtTasksCount >= RT_TASKS_MAX_COUNT
+			|| periodMicros == 0 || (periodMicros % BASE_PERIOD_MICROS) != 0) {
+		return DRIVER_STATUS_ERROR;
+	}
+
+	size_t index = rtTasksCount;
+	struct rtTask * task = &rtTasks[index];
+	task->vector = vector;
+	task->argument = argument;
+	task->periodTicks = periodMicros / BASE_PERIOD_MICROS;
+	task->countdown = task->periodTicks;
+	task->pending = false;
+	task->running = false;
+	task->stats.runCount = 0;
+	task->stats.overrunCount = 0;
+	task->stats.runCyclesMax = 0;
+
+	// insertion in runOrder, after the tasks of the same period
+	size_t position = rtTasksCount;
+	while (position > 0 && rtTasks[runOrder[position - 1]].periodTicks > task->periodTicks) {
+		runOrder[position] = runOrder[position - 1];
+		position--;
+	}
+	runOrder[position] = (uint8_t) index;
+	rtTasksCount++;
+
+	return (int) index;
+}
+
+int rtTasks_start(void) {
+	if (started || rtTasksCount == 0) {
+		return DRIVER_STATUS_ERROR;
+	}
+
+	sysTimer_EnableCycleCounter();
+	__HAL_RCC_TIM4_CLK_ENABLE();
+
+	// the APB1 timers run at twice PCLK1 when the APB1 prescaler isn't 1
+	uint32_t timerClock = HAL_RCC_GetPCLK1Freq();
+	if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+		timerClock *= 2;
+	}
+
+	TIM4->CR1 = 0;
+	TIM4->PSC = (timerClock / TIMER_COUNT_FREQUENCY) - 1;
+	TIM4->ARR = BASE_PERIOD_MICROS - 1;
+	TIM4->EGR = TIM_EGR_UG;
+	TIM4->SR = 0;
+	TIM4->DIER = TIM_DIER_UIE;
+
+	HAL_NVIC_SetPriority(PendSV_IRQn, 15, 0);
+	HAL_NVIC_SetPriority(TIM4_IRQn, RT_TASKS_TIMER_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(TIM4_IRQn);
+
+	started = true;
+	TIM4->CR1 = TIM_CR1_CEN;
+	return DRIVER_STATUS_OK;
+}
+
+void rtTasks_stop(void) {
+	TIM4->CR1 = 0;
+	TIM4->DIER = 0;
+	HAL_NVIC_DisableIRQ(TIM4_IRQn);
+
+	// drop a pending PendSV so no task runs after the list is cleared
+	__disable_irq();
+	SCB->ICSR = SCB_ICSR_PENDSVCLR_Msk;
+	rtTasksCount = 0;
+	started = false;
+	__enable_irq();
+}
+
+bool rtTasks_getStats(int index, struct rtTasks_stats * stats) {
+	if (index < 0 || index >= (int) rtTasksCount || stats == NULL) {
+		return false;
+	}
+
+	// the counters are updated from the interrupts
+	__disable_irq();
+	*stats = rtTasks[index].stats;
+	__enable_irq();
+	return true;
+}
+
+void TIM4_IRQHandler(void) {
+	bool due = false;
+
+	TIM4->SR = ~TIM_SR_UIF;
+	for (size_t i = 0; i < rtTasksCount; i++) {
+		struct rtTask * task = &rtTasks[i];
+		if (--task->countdown > 0) {
+			continue;
+		}
+
+		task->countdown = task->periodTicks;
+		if (task->pending || task->running) {
+			task->stats.overrunCount++;
+		} else {
+			task->pending = true;
+			due = true;
+		}
+	}
+
+	if (due) {
+		SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+	}
+}
+
+void PendSV_Handler(void) {
+	for (size_t i = 0; i < rtTasksCount; i++) {
+		struct rtTask * task = &rtTasks[runOrder[i]];
+		if (!task->pending) {
+			continue;
+		}
+
+		task->running = true;
+		task->pending = false;
+		uint32_t startCycles = sysTimer_GetCycles();
+		task->vector(task->argument);
+		uint32_t runCycles = sysTimer_GetCycles() - startCycles;
+		task->running = false;
+
+		task->stats.runCount++;
+		if (runCycles > task->stats.runCyclesMax) {
+			task->stats.runCyclesMax = runCycles;
+		}
+
+		// a shorter period task could be due again, restart from the highest priority
+		i = (size_t) -1;
+	}
+}
+
+#endif /* RT_TASKS */
@@ -4,12 +4,23 @@
  * @author Mathieu Breault
  * @brief Basic task scheduler for event based system, without pre-emption.
  * 
- * The scheduler is implemented using 2 ordered lists, an array of list readyTasksLists and a 
- * waitTasksList. The readyTasksLists are in buckets according to their priority. 
+ * The scheduler is implemented using an array of list readyTasksLists and a waitTasksHeap. The
+ * readyTasksLists are in buckets according to their priority, and readyPriorityMap has one bit set
+ * for each non-empty bucket so the highest ready priority is found with a single count leading
+ * zeros (CLZ instruction on the cortex-m3). The waitTasksHeap is a binary min-heap
+ * of the waiting tasks ordered by their next run time, insertion and removal are O(log n) and the
+ * next task to wake up is always at the top.
+ * 
+ * Events posted from interrupts go through eventSlots, a bounded lock-free multi-producer single-consumer
+ * ring. A producer claims a position with a compare and swap on eventsHead, fills the slot and then
+ * publishes it through the slot sequence. Only runScheduler() consumes the slots, it creates the tasks
+ * from the main loop so the task lists are never modified from an interrupt.
  * 
  * When runScheduler() is called, it will sequentially checks the readyTasks by priorities and call the
- * next task's vector that is ready. It will then move any ready tasks from the waitTasksList to the
+ * next task's vector that is ready. It will then move any ready tasks from the waitTasksHeap to the
  * readyTasksLists.
+ * When no task is ready and no event is posted, the core sleeps until the top of the waitTasksHeap is
+ * due with sysTimer_IdleUntil(), any interrupt wakes it up early.
  * The user must periodically call runScheduler() in the work loop.
  */
 
@@ -35,52 +46,95 @@ struct task {
     uint8_t priority;
     uint32_t timeInterval;
     uint32_t timeLastEnd;
+    uint32_t timeNextRun;
     bool repeat;
+    enum scheduler_periodMode periodMode;
+    uint32_t overrunCount;
     enum taskStatus status;
+    uint8_t waitIndex; // position in waitTasksHeap, only valid in TASK_WAIT
+#ifdef SCHEDULER_PROFILING
+    uint32_t dueMicros; // sysTimer_GetMicros() when the task was due to run
+    struct scheduler_taskStats stats;
+#endif
 };
 
 static size_t tasksCount = 0;
 static struct task taskNodes[TASKS_MAX_COUNT];
 static struct task * nextEmptyTask = taskNodes;
 static struct linkedList readyTasksLists[TASKS_PRIORITY_COUNT];
-static struct linkedList waitTasksList;
+// bit (31 - priority) is set when readyTasksLists[priority] isn't empty
+static uint32_t readyPriorityMap = 0;
+static struct task * waitTasksHeap[TASKS_MAX_COUNT];
+static size_t waitTasksCount = 0;
+static volatile bool doExitScheduler = false;
+
+#define EVENTS_INDEX_MASK (SCHEDULER_EVENTS_MAX_COUNT - 1)
+
+/*
+ * The slot at position pos is free when its sequence is (pos & ~EVENTS_INDEX_MASK), the lap of pos, and
+ * holds a published event when it is that lap + 1. All sequences at 0 is an empty ring.
+ */
+struct postedEvent {
+    uint32_t sequence;
+    void (*vector)(uint32_t, void *);
+    uint32_t event;
+    void * argument;
+    uint8_t priority;
+};
+
+static struct postedEvent eventSlots[SCHEDULER_EVENTS_MAX_COUNT];
+static uint32_t eventsHead = 0; // shared by the producers
+static uint32_t eventsTail = 0; // only used by runScheduler()
+static uint32_t droppedEventsCount = 0;
+
+static struct scheduler_idleStats idleStats = {0, 0, 0};
 
 static bool initTasksLists(void);
+static void dispatchPostedEvents(void);
 static bool runNextReadyTask(void);
 static bool prepareNewReadyTasks(void);
+static void idleUntilNextTask(void);
+static bool eventsPending(void);
 static int compareWaitTasks(void * task1, void * task2);
 static bool toggleTaskWait(struct task * task);
 static bool toggleTaskReady(struct task * task);
+static uint32_t nextRunTime(struct task * task);
+static void readyListAdd(struct task * task);
+static void readyListRemove(struct task * task);
+static void waitHeapPush(struct task * task);
+static struct task * waitHeapRemove(size_t index);
+static void waitHeapSiftUp(size_t index);
+static void waitHeapSiftDown(size_t index);
+#ifdef SCHEDULER_PROFILING
+static void clearTaskStats(struct task * task);
+static void recordTaskRun(struct task * task, uint32_t startMicros, uint32_t runCycles);
+#endif
 
 bool runScheduler(void) {
     if (tasksCount == 0) {
         return false;
     }
 
-    bool doExitScheduler = false;
+    doExitScheduler = false;
     while (!doExitScheduler) {
+        dispatchPostedEvents();
         runNextReadyTask();
         prepareNewReadyTasks();
+        idleUntilNextTask();
     }
 
     return true;
 }
 
-static inline bool timeIsAfter(uint32_t a, uint32_t b) {
-    return ((int32_t) (b - a) < 0);
-
-}
-
-static inline bool timeIsBefore(uint32_t a, uint32_t b) {
-//    return ((a - b) < (UINT32_MAX / 2));
-    return timeIsAfter(b, a);
+void scheduler_exit(void) {
+    doExitScheduler = true;
 }
 
 // Returns NULL on error
 struct task * createTask(void (*vector)(uint32_t, void *), uint32_t event, void * argument,
 		uint32_t timeInterval, bool repeat, uint8_t priority) {
     // TODO verify input values
-    if (tasksCount >= TASKS_MAX_COUNT || vector == NULL) {
+    if (tasksCount >= TASKS_MAX_COUNT || vector == NULL || priority >= TASKS_PRIORITY_COUNT) {
         return NULL;
     }
 
@@ -100,15 +154,21 @@ struct task * createTask(void (*vector)(uint32_t, void *), uint32_t event, void
     newTask->priority = priority;
     newTask->timeInterval = timeInterval;
     newTask->timeLastEnd = 0;
+    newTask->timeNextRun = sysTimer_GetTick();
     newTask->repeat = repeat;
+    newTask->periodMode = SCHEDULER_PERIOD_FROM_END;
+    newTask->overrunCount = 0;
     newTask->status = TASK_READY;
+#ifdef SCHEDULER_PROFILING
+    newTask->dueMicros = sysTimer_GetMicros();
+    clearTaskStats(newTask);
+#endif
     tasksCount++;
 
     // task must always be in exactly one status list
     // init as ready to run
     linkedList_initNode((struct linkedList_node *) newTask, newTask);
-    struct linkedList * readyList = &readyTasksLists[newTask->priority];
-    linkedList_addBefore(readyList, (struct linkedList_node *) newTask, &readyList->head);
+    readyListAdd(newTask);
 
     return newTask;
 }
@@ -119,7 +179,11 @@ bool destroyTask(struct task * task) {
         return false;
     }
 
-    linkedList_remove((struct linkedList_node *) task);
+    if (task->status == TASK_WAIT) {
+        waitHeapRemove(task->waitIndex);
+    } else {
+        readyListRemove(task);
+    }
     task->vector = NULL;
     task->argument = NULL;
 
@@ -131,72 +195,218 @@ bool destroyTask(struct task * task) {
     return true;
 }
 
-static bool runNextReadyTask(void) {
-    // priority High to Low
-    for (int priority = 0; priority < TASKS_PRIORITY_COUNT; priority++) {
-        if (readyTasksLists[priority].length > 0) {
-            struct task * nextTask = readyTasksLists[priority].head.next->element;
-            nextTask->vector(nextTask->event, nextTask->argument);
-            nextTask->timeLastEnd = sysTimer_GetTick();
-            // skip toggle/destroy if the task destroyed itself
-            if (nextTask->vector != NULL) {
-                if (nextTask->repeat) {
-                    toggleTaskWait(nextTask);
-                } else {
-                    destroyTask(nextTask);
-                }
-            }
+bool scheduler_postEvent(void (*vector)(uint32_t, void *), uint32_t event, void * argument, uint8_t priority) {
+    if (vector == NULL || priority >= TASKS_PRIORITY_COUNT) {
+        return false;
+    }
 
-            break;
+    uint32_t position = __atomic_load_n(&eventsHead, __ATOMIC_RELAXED);
+    while (true) {
+        struct postedEvent * slot = &eventSlots[position & EVENTS_INDEX_MASK];
+        uint32_t lap = position & ~EVENTS_INDEX_MASK;
+        int32_t difference = (int32_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - lap);
+
+        if (difference == 0) {
+            // claim the position, on failure position is reloaded with the current head
+            if (__atomic_compare_exchange_n(&eventsHead, &position, position + 1, false,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->vector = vector;
+                slot->event = event;
+                slot->argument = argument;
+                slot->priority = priority;
+                __atomic_store_n(&slot->sequence, lap + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (difference < 0) {
+            // slot still holds the event of the previous lap, the ring is full
+            __atomic_fetch_add(&droppedEventsCount, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            // an other producer claimed this position
+            position = __atomic_load_n(&eventsHead, __ATOMIC_RELAXED);
         }
     }
+}
+
+uint32_t scheduler_getDroppedEventCount(void) {
+    return __atomic_load_n(&droppedEventsCount, __ATOMIC_RELAXED);
+}
+
+bool scheduler_setPeriodMode(struct task * task, enum scheduler_periodMode mode) {
+    if (task == NULL) {
+        return false;
+    }
+    task->periodMode = mode;
     return true;
 }
 
-static bool prepareNewReadyTasks(void) {
-    uint32_t currentTime = sysTimer_GetTick();
+uint32_t scheduler_getOverrunCount(struct task * task) {
+    return (task != NULL) ? task->overrunCount : 0;
+}
+
+void scheduler_getIdleStats(struct scheduler_idleStats * stats) {
+    if (stats != NULL) {
+        *stats = idleStats;
+    }
+}
+
+void scheduler_resetIdleStats(void) {
+    idleStats.sleepCount = 0;
+    idleStats.idleMicros = 0;
+    idleStats.sinceTick = sysTimer_GetTick();
+}
 
-    if (waitTasksList.length <= 0) {
+static bool runNextReadyTask(void) {
+    if (readyPriorityMap == 0) {
         return true;
     }
-    struct task * taskCursor = (struct task *) waitTasksList.head.next;
-    while (taskCursor != (struct task *) &waitTasksList.head) {
-        uint32_t nextTaskRunTime = taskCursor->timeLastEnd + taskCursor->timeInterval;
-        if (timeIsBefore(nextTaskRunTime, currentTime) || (nextTaskRunTime == currentTime)) {
-            // Update cursor before setting task to ready, since the task's list will change
-            taskCursor = (struct task *) taskCursor->link.next;
-            toggleTaskReady((struct task *) taskCursor->link.previous);
+
+    // highest priority (lowest value) ready bucket, gcc builtin for the CMSIS __CLZ instruction
+    int priority = __builtin_clz(readyPriorityMap);
+    struct task * nextTask = readyTasksLists[priority].head.next->element;
+#ifdef SCHEDULER_PROFILING
+    uint32_t startMicros = sysTimer_GetMicros();
+    uint32_t startCycles = sysTimer_GetCycles();
+    nextTask->vector(nextTask->event, nextTask->argument);
+    uint32_t runCycles = sysTimer_GetCycles() - startCycles;
+    // a task that destroyed itself has no stats left to update
+    if (nextTask->vector != NULL) {
+        recordTaskRun(nextTask, startMicros, runCycles);
+    }
+#else
+    nextTask->vector(nextTask->event, nextTask->argument);
+#endif
+    nextTask->timeLastEnd = sysTimer_GetTick();
+    // skip toggle/destroy if the task destroyed itself
+    if (nextTask->vector != NULL) {
+        if (nextTask->repeat) {
+            toggleTaskWait(nextTask);
         } else {
+            destroyTask(nextTask);
+        }
+    }
+    return true;
+}
+
+static void dispatchPostedEvents(void) {
+    while (true) {
+        struct postedEvent * slot = &eventSlots[eventsTail & EVENTS_INDEX_MASK];
+        uint32_t lap = eventsTail & ~EVENTS_INDEX_MASK;
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != (lap + 1)) {
             break;
         }
+
+        // keep the event queued until a task is free
+        if (createTask(slot->vector, slot->event, slot->argument, 0, false, slot->priority) == NULL) {
+            break;
+        }
+
+        // free the slot for the next lap
+        __atomic_store_n(&slot->sequence, lap + SCHEDULER_EVENTS_MAX_COUNT, __ATOMIC_RELEASE);
+        eventsTail++;
+    }
+}
+
+static bool prepareNewReadyTasks(void) {
+    uint32_t currentTime = sysTimer_GetTick();
+
+    // the top of the heap is always the next task to wake up
+    while (waitTasksCount > 0 && !sysTimer_timeIsAfter(waitTasksHeap[0]->timeNextRun, currentTime)) {
+#ifdef SCHEDULER_PROFILING
+        // back to the tick it was due when the task is made ready late
+        struct task * task = waitTasksHeap[0];
+        task->dueMicros = sysTimer_GetMicros() - (currentTime - task->timeNextRun) * 1000;
+#endif
+        toggleTaskReady(waitTasksHeap[0]);
     }
     return true;
 }
 
+static void idleUntilNextTask(void) {
+    // an empty heap would have nothing to wake up for but an interrupt, keep polling instead
+    if (readyPriorityMap != 0 || waitTasksCount == 0 || doExitScheduler) {
+        return;
+    }
+
+    uint32_t sleptMicros = sysTimer_IdleUntil(waitTasksHeap[0]->timeNextRun, eventsPending);
+    if (sleptMicros > 0) {
+        idleStats.sleepCount++;
+        idleStats.idleMicros += sleptMicros;
+    }
+}
+
+// called with the interrupts masked, an event posted after this check wakes up the core
+static bool eventsPending(void) {
+    struct postedEvent * slot = &eventSlots[eventsTail & EVENTS_INDEX_MASK];
+    uint32_t lap = eventsTail & ~EVENTS_INDEX_MASK;
+    return __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == (lap + 1);
+}
+
 static bool toggleTaskWait(struct task * task) {
+    readyListRemove(task);
     task->status = TASK_WAIT;
-    linkedList_remove((struct linkedList_node *) task);
-    linkedList_addOrdered(&waitTasksList, (struct linkedList_node *) task, compareWaitTasks);
+    task->timeNextRun = nextRunTime(task);
+    waitHeapPush(task);
     return true;
 }
 
+/*
+ * In the deadline modes timeNextRun still holds the deadline of the run that just ended, the next
+ * deadline is one interval after it no matter how late the task started or how long it ran.
+ */
+static uint32_t nextRunTime(struct task * task) {
+    if (task->periodMode == SCHEDULER_PERIOD_FROM_END || task->timeInterval == 0) {
+        return task->timeLastEnd + task->timeInterval;
+    }
+
+    uint32_t deadline = task->timeNextRun + task->timeInterval;
+    if (!sysTimer_timeIsBefore(deadline, task->timeLastEnd)) {
+        return deadline;
+    }
+
+    // the next period already started before the end of this run
+    if (task->periodMode == SCHEDULER_PERIOD_DEADLINE_BURST) {
+        task->overrunCount++;
+        return deadline;
+    }
+
+    // skip to the first deadline after the end of the run
+    uint32_t missedPeriods = (task->timeLastEnd - deadline) / task->timeInterval + 1;
+    task->overrunCount += missedPeriods;
+    return deadline + missedPeriods * task->timeInterval;
+}
+
 static bool toggleTaskReady(struct task * task) {
+    if (task->status == TASK_WAIT) {
+        waitHeapRemove(task->waitIndex);
+    } else {
+        readyListRemove(task);
+    }
     task->status = TASK_READY;
-    linkedList_remove((struct linkedList_node *) task);
+    readyListAdd(task);
+    return true;
+}
+
+static void readyListAdd(struct task * task) {
     struct linkedList * readyList = &readyTasksLists[task->priority];
     linkedList_addBefore(readyList, (struct linkedList_node *) task, &readyList->head);
-    return true;
+    readyPriorityMap |= (UINT32_C(0x80000000) >> task->priority);
+}
+
+static void readyListRemove(struct task * task) {
+    linkedList_remove((struct linkedList_node *) task);
+    if (readyTasksLists[task->priority].length == 0) {
+        readyPriorityMap &= ~(UINT32_C(0x80000000) >> task->priority);
+    }
 }
 
 static int compareWaitTasks(void * task1, void * task2) {
     struct task * t1 = task1;
     struct task * t2 = task2;
-    uint32_t t1TimeNextRun = t1->timeLastEnd + t1->timeInterval;
-    uint32_t t2TimeNextRun = t2->timeLastEnd + t2->timeInterval;
 
-    if (timeIsBefore(t1TimeNextRun, t2TimeNextRun)) {
+    if (sysTimer_timeIsBefore(t1->timeNextRun, t2->timeNextRun)) {
         return -1;
-    } else if (timeIsAfter(t1TimeNextRun, t2TimeNextRun)) {
+    } else if (sysTimer_timeIsAfter(t1->timeNextRun, t2->timeNextRun)) {
         return 1;
     } else {
         return 0;
@@ -204,16 +414,129 @@ static int compareWaitTasks(void * task1, void * task2) {
 
 }
 
+static inline void waitHeapSet(size_t index, struct task * task) {
+    waitTasksHeap[index] = task;
+    task->waitIndex = (uint8_t) index;
+}
+
+static void waitHeapPush(struct task * task) {
+    waitHeapSet(waitTasksCount, task);
+    waitTasksCount++;
+    waitHeapSiftUp(waitTasksCount - 1);
+}
+
+// Removes the task at index from the heap, the last task takes its place and is moved back in order.
+static struct task * waitHeapRemove(size_t index) {
+    struct task * removed = waitTasksHeap[index];
+    waitTasksCount--;
+    if (index != waitTasksCount) {
+        struct task * moved = waitTasksHeap[waitTasksCount];
+        waitHeapSet(index, moved);
+        waitHeapSiftUp(index);
+        waitHeapSiftDown(moved->waitIndex);
+    }
+    waitTasksHeap[waitTasksCount] = NULL;
+    return removed;
+}
+
+static void waitHeapSiftUp(size_t index) {
+    struct task * task = waitTasksHeap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (compareWaitTasks(task, waitTasksHeap[parent]) >= 0) {
+            break;
+        }
+        waitHeapSet(index, waitTasksHeap[parent]);
+        index = parent;
+    }
+    waitHeapSet(index, task);
+}
+
+static void waitHeapSiftDown(size_t index) {
+    struct task * task = waitTasksHeap[index];
+    while (true) {
+        size_t child = 2 * index + 1;
+        if (child >= waitTasksCount) {
+            break;
+        }
+        if ((child + 1) < waitTasksCount && compareWaitTasks(waitTasksHeap[child + 1], waitTasksHeap[child]) < 0) {
+            child++;
+        }
+        if (compareWaitTasks(waitTasksHeap[child], task) >= 0) {
+            break;
+        }
+        waitHeapSet(index, waitTasksHeap[child]);
+        index = child;
+    }
+    waitHeapSet(index, task);
+}
+
 static bool initTasksLists(void) {
     // last node must keep a NULL nextEmpty
     for (int i = 0; i < (TASKS_MAX_COUNT - 1); i++) {
         taskNodes[i].nextEmpty = &taskNodes[i + 1];
     }
+    taskNodes[TASKS_MAX_COUNT - 1].nextEmpty = NULL;
+    nextEmptyTask = taskNodes;
 
     for (int i = 0; i < TASKS_PRIORITY_COUNT; i++) {
         linkedList_initList(&readyTasksLists[i]);
     }
-    linkedList_initList(&waitTasksList);
+    readyPriorityMap = 0;
+    waitTasksCount = 0;
+
+#ifdef SCHEDULER_PROFILING
+    sysTimer_EnableCycleCounter();
+#endif
 
     return true;
 }
+
+#ifdef SCHEDULER_PROFILING
+
+bool scheduler_getTaskStats(size_t index, struct scheduler_taskStats * stats) {
+    if (index >= TASKS_MAX_COUNT || taskNodes[index].vector == NULL || stats == NULL) {
+        return false;
+    }
+    *stats = taskNodes[index].stats;
+    stats->overrunCount = taskNodes[index].overrunCount;
+    return true;
+}
+
+void scheduler_resetTaskStats(void) {
+    for (int i = 0; i < TASKS_MAX_COUNT; i++) {
+        clearTaskStats(&taskNodes[i]);
+    }
+}
+
+static void clearTaskStats(struct task * task) {
+    task->stats.vector = task->vector;
+    task->stats.runCount = 0;
+    task->stats.runCyclesMin = UINT32_MAX;
+    task->stats.runCyclesMax = 0;
+    task->stats.runCyclesTotal = 0;
+    task->stats.startLatencyMin = UINT32_MAX;
+    task->stats.startLatencyMax = 0;
+}
+
+static void recordTaskRun(struct task * task, uint32_t startMicros, uint32_t runCycles) {
+    struct scheduler_taskStats * stats = &task->stats;
+    uint32_t latency = sysTimer_timeIsAfter(startMicros, task->dueMicros) ? (startMicros - task->dueMicros) : 0;
+
+    stats->runCount++;
+    stats->runCyclesTotal += runCycles;
+    if (runCycles < stats->runCyclesMin) {
+        stats->runCyclesMin = runCycles;
+    }
+    if (runCycles > stats->runCyclesMax) {
+        stats->runCyclesMax = runCycles;
+    }
+    if (latency < stats->startLatencyMin) {
+        stats->startLatencyMin = latency;
+    }
+    if (latency > stats->startLatencyMax) {
+        stats->startLatencyMax = latency;
+    }
+}
+
+#endif /* SCHEDULER_PROFILING */
@@ -43,7 +43,9 @@ void HAL_MspDeInit(void)
 }
 
 /**
- * @brief initialization of the low-level gpio for the UART peripherals.
+ * @brief initialization of the low-level gpio and DMA for the UART peripherals.
+ * 
+ * The DMA handles are configured and linked to the huart by uart.c, only the channels are initialized here.
  */
 void HAL_UART_MspInit(UART_HandleTypeDef * huart) {
 	if (huart->Instance == USART2_DEVICE) {
@@ -70,6 +72,14 @@ void HAL_UART_MspInit(UART_HandleTypeDef * huart) {
 		HAL_NVIC_SetPriority(USART2_IRQn, 0, 2);
 		HAL_NVIC_EnableIRQ(USART2_IRQn);
 		
+		__HAL_RCC_DMA1_CLK_ENABLE();
+		HAL_DMA_Init(huart->hdmatx);
+		HAL_NVIC_SetPriority(USART2_TX_DMA_IRQ, 0, 2);
+		HAL_NVIC_EnableIRQ(USART2_TX_DMA_IRQ);
+		HAL_DMA_Init(huart->hdmarx);
+		HAL_NVIC_SetPriority(USART2_RX_DMA_IRQ, 0, 2);
+		HAL_NVIC_EnableIRQ(USART2_RX_DMA_IRQ);
+		
 	} else if (huart->Instance == USART1_DEVICE) {
 		__HAL_RCC_USART1_CLK_ENABLE();
 		EnableGpioClock(USART1_RX_PORT);
@@ -90,16 +100,31 @@ void HAL_UART_MspInit(UART_HandleTypeDef * huart) {
 		
 		HAL_GPIO_Init(USART1_RX_PORT, &gpioInit);
 		
+		// RTS is an output of the usart, CTS an input that holds the transmission while high
 		gpioInit.Pin = USART1_RTS_PIN;
-		gpioInit.Mode = GPIO_MODE_AF_INPUT;
+		gpioInit.Mode = GPIO_MODE_AF_PP;
 		gpioInit.Pull = GPIO_NOPULL;
 		gpioInit.Speed = GPIO_SPEED_FREQ_HIGH;
 		
 		HAL_GPIO_Init(USART1_RTS_PORT, &gpioInit);
 		
+		gpioInit.Pin = USART1_CTS_PIN;
+		gpioInit.Mode = GPIO_MODE_INPUT;
+		gpioInit.Pull = GPIO_PULLUP;
+		
+		HAL_GPIO_Init(USART1_CTS_PORT, &gpioInit);
+		
 		// Enable the NVIC for the usart1
 		HAL_NVIC_SetPriority(USART1_IRQn, 0, 1);
 		HAL_NVIC_EnableIRQ(USART1_IRQn);
+		
+		__HAL_RCC_DMA1_CLK_ENABLE();
+		HAL_DMA_Init(huart->hdmatx);
+		HAL_NVIC_SetPriority(USART1_TX_DMA_IRQ, 0, 1);
+		HAL_NVIC_EnableIRQ(USART1_TX_DMA_IRQ);
+		HAL_DMA_Init(huart->hdmarx);
+		HAL_NVIC_SetPriority(USART1_RX_DMA_IRQ, 0, 1);
+		HAL_NVIC_EnableIRQ(USART1_RX_DMA_IRQ);
 	}
 }
 
@@ -140,6 +140,7 @@ void DebugMon_Handler(void)
 {
 }
 
+#ifndef RT_TASKS /* rtTasks.c handles PendSV */
 /**
   * @brief  This function handles PendSVC exception.
   * @param  None
@@ -148,6 +149,7 @@ void DebugMon_Handler(void)
 void PendSV_Handler(void)
 {
 }
+#endif
 
 /******************************************************************************/
 /*                 STM32F1xx Peripherals Interrupt Handlers                   */
@@ -8,14 +8,193 @@
 #include "sysTimer.h"
 #include "main.h"
 
+/*
+ * The HAL tick is implemented here instead of the HAL weak functions so the count can be corrected
+ * after a tickless sleep.
+ */
+static volatile uint32_t msTick = 0;
+/*
+ * The tick boundaries on the microsecond clock, anchorMicros is the start of the tick anchorTick. SysTick
+ * and TIM2 run from the same clock so the boundaries stay where they are while SysTick runs, a sleep 
+ * corrects msTick and the SysTick phase from them.
+ */
+static uint32_t anchorTick;
+static uint32_t anchorMicros;
+
+#define MICROS_TIMER_FREQUENCY 1000000
+
+/*
+ * TIM2 is the low half of the microsecond clock, its update event is the trigger output (TRGO) which
+ * clocks TIM3 in external clock mode 1 through ITR1.
+ */
+void sysTimer_init(void) {
+    __HAL_RCC_TIM2_CLK_ENABLE();
+    __HAL_RCC_TIM3_CLK_ENABLE();
+    
+    // the APB1 timers run at twice PCLK1 when the APB1 prescaler isn't 1
+    uint32_t timerClock = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        timerClock *= 2;
+    }
+    
+    TIM2->CR1 = 0;
+    TIM3->CR1 = 0;
+    
+    TIM3->PSC = 0;
+    TIM3->ARR = 0xFFFF;
+    TIM3->SMCR = TIM_TS_ITR1 | TIM_SLAVEMODE_EXTERNAL1;
+    
+    TIM2->PSC = (timerClock / MICROS_TIMER_FREQUENCY) - 1;
+    TIM2->ARR = 0xFFFF;
+    TIM2->CR2 = TIM_TRGO_UPDATE;
+    
+    // load the prescalers, the update event from TIM2 would also increment TIM3
+    TIM3->EGR = TIM_EGR_UG;
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CNT = 0;
+    TIM3->CNT = 0;
+    TIM2->SR = 0;
+    TIM3->SR = 0;
+    
+    TIM3->CR1 = TIM_CR1_CEN;
+    TIM2->CR1 = TIM_CR1_CEN;
+    
+    // anchor the running SysTick on the microsecond clock
+    __disable_irq();
+    uint32_t cyclesPerMicro = SystemCoreClock / 1000000;
+    uint32_t tickCycles = SysTick->LOAD - SysTick->VAL;
+    anchorTick = msTick;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        // the counter already reloaded for the next tick
+        anchorTick++;
+    }
+    anchorMicros = sysTimer_GetMicros() - (tickCycles / cyclesPerMicro);
+    __enable_irq();
+}
+
 void SysTick_Handler(void)
 {
   HAL_IncTick();
 }
 
+void HAL_IncTick(void) {
+    msTick++;
+}
+
+uint32_t HAL_GetTick(void) {
+    return msTick;
+}
+
 uint32_t sysTimer_GetTick(void) {
     return HAL_GetTick();
 }
 
+/*
+ * TIM3 counts through TRGO a few cycles after TIM2 wraps to 0, a read in between would pair the new
+ * low half with the old high half, 65536 us in the past. The low half 0 is only accepted once TIM2 
+ * counted to 1, TIM3 has counted long before that. The read is repeated until the high half is stable
+ * around it, a wait of at most 1 us every 65.5 ms.
+ */
+uint32_t sysTimer_GetMicros(void) {
+    uint32_t high;
+    uint32_t low;
+    uint32_t highCheck;
+    
+    do {
+        high = TIM3->CNT;
+        low = TIM2->CNT;
+        highCheck = TIM3->CNT;
+    } while (high != highCheck || low == 0);
+    return (high << 16) | low;
+}
+
+/*
+ * SysTick is reloaded with the cycles from now to the start of wakeTick, the 24 bit reload limits a
+ * single sleep to about 230 ticks at 72 MHz. The core uses the sleep mode, the stop mode would also stop
+ * the PLL and SysTick.
+ * 
+ * The cycles counted by SysTick are lost when it is stopped and reloaded, so the tick count and the 
+ * phase of SysTick after the sleep are computed from the microsecond clock and the anchor instead. The 
+ * error of a sleep is below a microsecond and doesn't add up from one sleep to the next.
+ */
+uint32_t sysTimer_IdleUntil(uint32_t wakeTick, bool (*wakeUpPending)(void)) {
+    // WFI still wakes up on a pending interrupt while they are masked
+    __disable_irq();
+
+    uint32_t sleepTicks = wakeTick - msTick;
+    if ((int32_t) sleepTicks <= 0 || (wakeUpPending != NULL && wakeUpPending())) {
+        __enable_irq();
+        return 0;
+    }
+
+    // a tick is due, let it be counted instead of sleeping
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        __enable_irq();
+        return 0;
+    }
+
+    // every tick counted since the anchor was a whole millisecond
+    anchorMicros += (msTick - anchorTick) * 1000;
+    anchorTick = msTick;
+
+    uint32_t cyclesPerMicro = SystemCoreClock / 1000000;
+    uint32_t maxSleepMicros = SysTick_LOAD_RELOAD_Msk / cyclesPerMicro;
+    uint32_t startMicros = sysTimer_GetMicros();
+    uint32_t sleepMicros = sleepTicks * 1000 - (startMicros - anchorMicros);
+    if ((int32_t) sleepMicros <= 0) {
+        // SysTick is a few cycles behind the microsecond clock, its tick is about to come
+        __enable_irq();
+        return 0;
+    }
+    if (sleepMicros > maxSleepMicros) {
+        sleepMicros = maxSleepMicros;
+    }
+
+    // a tick that comes before the reload is pending and wakes up the core right away
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    SysTick->LOAD = (sleepMicros * cyclesPerMicro) - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+
+    __DSB();
+    __WFI();
+    __ISB();
+
+    // the ticks of the sleep are counted here, a SysTick interrupt pending since the wake up would count one twice
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+
+    uint32_t wakeMicros = sysTimer_GetMicros();
+    uint32_t sinceAnchor = wakeMicros - anchorMicros;
+    uint32_t ticks = sinceAnchor / 1000;
+    msTick = anchorTick + ticks;
+    anchorTick = msTick;
+    anchorMicros += ticks * 1000;
+
+    /*
+     * Finish the current tick, the counter loads LOAD on the clock after VAL is cleared. LOAD is only
+     * used again at the next reload, it can be set back to a whole tick once the counter has started.
+     */
+    SysTick->LOAD = ((1000 - (sinceAnchor % 1000)) * cyclesPerMicro) - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    while (SysTick->VAL == 0) {
+    }
+    SysTick->LOAD = (SystemCoreClock / 1000) - 1;
+
+    __enable_irq();
+    return wakeMicros - startMicros;
+}
+
+void sysTimer_EnableCycleCounter(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t sysTimer_GetCycles(void) {
+    return DWT->CYCCNT;
+}
+
 
 
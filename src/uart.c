@@ -4,16 +4,55 @@
  * @author Mathieu Breault
  * @brief Basic interupt based uart driver to send logging data.
  * 
+ * The transmit buffer is sent by DMA, one linear segment from buffer_peekLinear() at a time. The
+ * transmit complete callback advances the buffer and starts the next segment, the part wrapped at
+ * the start of the array. A segment costs the DMA and the USART transmit complete interrupts instead of
+ * one TXE interrupt per byte. Build with UART_TX_IT to send with the previous interrupt per byte path,
+ * eg. to compare the load with the #SI command.
+ * 
+ * The receive DMA runs in circular mode directly in the array of bufferRx, it is the producer of the 
+ * buffer. The received data is published with buffer_commitIndex() at the DMA half and full transfer 
+ * interrupts and at the USART IDLE interrupt, after a frame. The position of the DMA is all that is
+ * published, a whole lap of the array between two interrupts can't be seen in it. Each half and full
+ * transfer interrupt checks that the DMA is still in the half after its own position, else it ran more
+ * than BUFFER_RX_MAX_SIZE / 2 bytes late and a lap may be lost. BUFFER_RX_MAX_SIZE is sized so this
+ * takes the interrupt held off for 22 ms at 57600 bauds. That case and a reader that falls more than
+ * BUFFER_RX_MAX_SIZE behind, which the DMA overwrites, are counted by uart_getRxOverrunCount().
+ * 
+ * Each port has two transmit lanes, urgent (bufferTx) and bulk (bufferBulk). The bulk data is queued in
+ * records of at most UART_BULK_RECORD_MAX_SIZE bytes, their lengths are kept in bulkRecords. The lane
+ * of the next segment is only chosen at a record boundary and the urgent lane always goes first, so the
+ * urgent data waits at most for the end of one bulk record whatever the size of the bulk queue.
+ * 
+ * USART1 runs with RTS/CTS flow control. The USART itself holds the next byte while CTS is deasserted,
+ * and sendNext() doesn't start a segment then, txLane is set to txLaneHeld and the CTS change interrupt
+ * resumes the transmission. The lane is only chosen when the XBee can take the data, urgent data queued 
+ * during a stall goes before the bulk records. The CTS interrupt also times the stalls for 
+ * uart_getFlowStats(), a port without a CTS pin has a NULL ctsPort.
+ * 
+ * Build with UART_LEAN_IRQ to replace the DMA and HAL_UART_IRQHandler() with a register level handler,
+ * the HAL is then only used to initialize the USART. The handler moves one byte per RXNE or TXE 
+ * interrupt directly between the data register and the buffers, it overrides UART_TX_IT.
+ * 
+ * Build with UART_IRQ_PROFILING to count the cycles spent in the USART and DMA interrupt handlers and
+ * the bytes they move, to compare both paths with the #UI command.
  */
  
 #include <stdbool.h> 
 
 #include "uart.h"
 #include "circularBuffer.h"
+#include "elementBuffer.h"
+#include "pinmapping.h"
+#include "scheduler.h"
+#include "sysTimer.h"
 #include "stm32f1xx_hal.h"
 
 #define BUFFER_TX_MAX_SIZE 512
-#define BUFFER_RX_MAX_SIZE 64
+#define BUFFER_RX_MAX_SIZE 256
+#define RX_NO_DMA_EVENT BUFFER_RX_MAX_SIZE // publishReceived() from the IDLE interrupt
+#define BUFFER_BULK_MAX_SIZE 256
+#define BULK_RECORDS_MAX_COUNT 16
 
 
 #define DEFAULT_BAUDRATE 115200
@@ -24,17 +63,72 @@
 #define DEFAULT_HWFLOWCTL UART_HWCONTROL_NONE
 #define DEFAULT_OVERSAMPLING UART_OVERSAMPLING_16
 
+// bit-band alias of a bit in a peripheral register, a single store sets or clears it atomically
+#define PERIPH_BITBAND(reg, bit) \
+	(*(volatile uint32_t *) (PERIPH_BB_BASE + (((uintptr_t) &(reg) - PERIPH_BASE) * 32) + ((bit) * 4)))
+
+#define LEAN_RX_FLAGS (USART_SR_RXNE | USART_SR_ORE | USART_SR_NE | USART_SR_FE | USART_SR_PE)
+
+#ifdef UART_IRQ_PROFILING
+#define IRQ_PROFILE_START() uint32_t irqStartCycles = sysTimer_GetCycles()
+#define IRQ_PROFILE_END(device) recordIrq((device), sysTimer_GetCycles() - irqStartCycles)
+#define IRQ_PROFILE_BYTES(device, count) ((device)->irqStats.bytes += (count))
+#else
+#define IRQ_PROFILE_START()
+#define IRQ_PROFILE_END(device)
+#define IRQ_PROFILE_BYTES(device, count)
+#endif
+
+#define DEFAULT_TX_DMA_INIT { \
+	.Direction = DMA_MEMORY_TO_PERIPH, \
+	.PeriphInc = DMA_PINC_DISABLE, \
+	.MemInc = DMA_MINC_ENABLE, \
+	.PeriphDataAlignment = DMA_PDATAALIGN_BYTE, \
+	.MemDataAlignment = DMA_MDATAALIGN_BYTE, \
+	.Mode = DMA_NORMAL, \
+	.Priority = DMA_PRIORITY_LOW, \
+}
+
+#define DEFAULT_RX_DMA_INIT { \
+	.Direction = DMA_PERIPH_TO_MEMORY, \
+	.PeriphInc = DMA_PINC_DISABLE, \
+	.MemInc = DMA_MINC_ENABLE, \
+	.PeriphDataAlignment = DMA_PDATAALIGN_BYTE, \
+	.MemDataAlignment = DMA_MDATAALIGN_BYTE, \
+	.Mode = DMA_CIRCULAR, \
+	.Priority = DMA_PRIORITY_MEDIUM, \
+}
+
 /*
  * UART_HandleTypeDef must stay as the first member of this struct so it can be cast back to 
  * struct uart_Peripheral in the callback from the hal.
  */
 struct uart_Peripheral {
 	UART_HandleTypeDef huart;
+	DMA_HandleTypeDef hdmaTx;
+	DMA_HandleTypeDef hdmaRx;
 	struct circularBuffer bufferTx;
 	uint8_t bufferTxArray[BUFFER_TX_MAX_SIZE];
+	struct circularBuffer bufferBulk;
+	uint8_t bufferBulkArray[BUFFER_BULK_MAX_SIZE];
+	struct elementBuffer bulkRecords; // uint16_t length of each bulk record
+	uint8_t bulkRecordsArray[ELEMENTBUFFER_ARRAY_SIZE(sizeof(uint16_t), BULK_RECORDS_MAX_COUNT)];
+	size_t bulkRemaining; // transmit side, bytes left to send of the current bulk record
+	struct circularBuffer * txLane; // lane of the segment being sent, NULL when the transmission is idle
 	struct circularBuffer bufferRx;
 	uint8_t bufferRxArray[BUFFER_RX_MAX_SIZE];
-	uint8_t memRxChar[4];
+	void (*rxEventVector)(uint32_t, void *);
+	void * rxEventArgument;
+	uint8_t rxEventPriority;
+	size_t rxBurstSize; // bytes received since the last IDLE
+	uint32_t rxOverrunCount;
+	GPIO_TypeDef * ctsPort; // NULL without CTS flow control
+	uint16_t ctsPin;
+	uint32_t stallStartMicros;
+	struct uart_flowStats flowStats;
+#ifdef UART_IRQ_PROFILING
+	struct uart_irqStats irqStats;
+#endif
 };
 
 static struct uart_Peripheral device_uart1 = {
@@ -46,9 +140,23 @@ static struct uart_Peripheral device_uart1 = {
 			.StopBits = DEFAULT_STOPBITS,
 			.Parity = DEFAULT_PARITY,
 			.Mode = DEFAULT_MODE,
-			.HwFlowCtl = UART_HWCONTROL_RTS,
+			.HwFlowCtl = UART_HWCONTROL_RTS_CTS,
 			.OverSampling = DEFAULT_OVERSAMPLING,
 		},
+		.hdmatx = &device_uart1.hdmaTx,
+		.hdmarx = &device_uart1.hdmaRx,
+	},
+	.ctsPort = USART1_CTS_PORT,
+	.ctsPin = USART1_CTS_PIN,
+	.hdmaTx = {
+		.Instance = USART1_TX_DMA_CHANNEL,
+		.Init = DEFAULT_TX_DMA_INIT,
+		.Parent = &device_uart1.huart,
+	},
+	.hdmaRx = {
+		.Instance = USART1_RX_DMA_CHANNEL,
+		.Init = DEFAULT_RX_DMA_INIT,
+		.Parent = &device_uart1.huart,
 	},
 };
 
@@ -64,13 +172,42 @@ static struct uart_Peripheral device_uart2 = {
                 .HwFlowCtl = DEFAULT_HWFLOWCTL,
                 .OverSampling = DEFAULT_OVERSAMPLING,
         },
+		.hdmatx = &device_uart2.hdmaTx,
+		.hdmarx = &device_uart2.hdmaRx,
+	},
+	.hdmaTx = {
+		.Instance = USART2_TX_DMA_CHANNEL,
+		.Init = DEFAULT_TX_DMA_INIT,
+		.Parent = &device_uart2.huart,
+	},
+	.hdmaRx = {
+		.Instance = USART2_RX_DMA_CHANNEL,
+		.Init = DEFAULT_RX_DMA_INIT,
+		.Parent = &device_uart2.huart,
 	},
 };
 
 McuDevice_UART mcuDevice_serialPC = &device_uart2;
 McuDevice_UART mcuDevice_serialXBee = &device_uart1;
 
-static int sendBuffer(UART_HandleTypeDef * device, struct circularBuffer * buffer);
+// txLane while the transmission is held by CTS, never used as a buffer
+static struct circularBuffer txLaneHeld;
+
+static struct circularBuffer * nextLane(struct uart_Peripheral * device);
+static void sendNext(struct uart_Peripheral * device);
+static void startTransmit(struct uart_Peripheral * device);
+static size_t publishReceived(struct uart_Peripheral * device, size_t dmaEventPosition);
+static void receiveIdle(struct uart_Peripheral * device);
+static void notifyReceived(struct uart_Peripheral * device, size_t received);
+static void ctsChanged(struct uart_Peripheral * device);
+static void updateStall(struct uart_Peripheral * device);
+static bool holdTransmit(struct uart_Peripheral * device);
+#ifdef UART_LEAN_IRQ
+static void leanIrqHandler(struct uart_Peripheral * device);
+#endif
+#ifdef UART_IRQ_PROFILING
+static void recordIrq(struct uart_Peripheral * device, uint32_t cycles);
+#endif
 
 
 int uart_open(McuDevice_UART UARTx, struct uart_ioConf * conf) {
@@ -85,9 +222,37 @@ int uart_open(McuDevice_UART UARTx, struct uart_ioConf * conf) {
 	};
 	
 	buffer_attachArray(&device->bufferTx, device->bufferTxArray, LENGTH_OF_ARRAY(device->bufferTxArray));
+	buffer_attachArray(&device->bufferBulk, device->bufferBulkArray, LENGTH_OF_ARRAY(device->bufferBulkArray));
+	buffer_setPolicy(&device->bufferBulk, BUFFER_POLICY_DROP_RECORD, BUFFER_NO_DELIMITER);
+	elementBuffer_attachArray(&device->bulkRecords, device->bulkRecordsArray, 
+			LENGTH_OF_ARRAY(device->bulkRecordsArray), sizeof(uint16_t));
+	device->bulkRemaining = 0;
+	device->txLane = NULL;
 	buffer_attachArray(&device->bufferRx, device->bufferRxArray, LENGTH_OF_ARRAY(device->bufferRxArray));
 	
-	HAL_UART_Receive_IT(&device->huart, device->memRxChar, 1);
+	if (device->ctsPort != NULL) {
+		device->flowStats = (struct uart_flowStats) {0};
+		updateStall(device);
+		__HAL_UART_CLEAR_FLAG(&device->huart, UART_FLAG_CTS);
+		__HAL_UART_ENABLE_IT(&device->huart, UART_IT_CTS);
+	}
+	
+#ifdef UART_IRQ_PROFILING
+	sysTimer_EnableCycleCounter();
+#endif
+	
+	device->rxBurstSize = 0;
+	device->rxOverrunCount = 0;
+#ifdef UART_LEAN_IRQ
+	__HAL_UART_CLEAR_IDLEFLAG(&device->huart);
+	SET_BIT(device->huart.Instance->CR1, USART_CR1_RXNEIE | USART_CR1_IDLEIE);
+#else
+	if (HAL_UART_Receive_DMA(&device->huart, device->bufferRxArray, BUFFER_RX_MAX_SIZE) != HAL_OK) {
+		return DRIVER_STATUS_ERROR;
+	}
+	__HAL_UART_CLEAR_IDLEFLAG(&device->huart);
+	__HAL_UART_ENABLE_IT(&device->huart, UART_IT_IDLE);
+#endif
 	
 	return DRIVER_STATUS_OK;
 }
@@ -118,18 +283,109 @@ int uart_ioctl_set(McuDevice_UART UARTx, int ioSetMask, struct uart_ioConf * con
 
 size_t uart_write(McuDevice_UART UARTx, uint8_t * data, size_t size) {
 	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
-	UART_HandleTypeDef * usartDeviceHandle = &device->huart;
-	struct circularBuffer * buffer = &device->bufferTx;
 	
-	size_t writtenSize = buffer_enqueue(buffer, data, size);
+	size_t writtenSize = buffer_enqueue(&device->bufferTx, data, size);
+	startTransmit(device);
+	return writtenSize;
+}
+
+size_t uart_writev(McuDevice_UART UARTx, const struct buffer_segment * segments, size_t count) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
 	
-	// send the buffer if nothing is waiting to send
-	if (buffer_peekSize(buffer) == 0) {
-		sendBuffer(usartDeviceHandle, buffer);
+	size_t writtenSize = buffer_enqueuev(&device->bufferTx, segments, count);
+	startTransmit(device);
+	return writtenSize;
+}
+
+size_t uart_writeBulk(McuDevice_UART UARTx, uint8_t * data, size_t size) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	size_t writtenSize = 0;
+	while (writtenSize < size) {
+		uint16_t recordSize = (size - writtenSize > UART_BULK_RECORD_MAX_SIZE) 
+				? UART_BULK_RECORD_MAX_SIZE : (uint16_t) (size - writtenSize);
+		if (elementBuffer_count(&device->bulkRecords) >= elementBuffer_capacity(&device->bulkRecords)
+				|| buffer_enqueue(&device->bufferBulk, data + writtenSize, recordSize) != recordSize) {
+			break;
+		}
+		// the length is published after the data, the transmit side only sends complete records
+		elementBuffer_push(&device->bulkRecords, &recordSize, 1);
+		writtenSize += recordSize;
 	}
+	startTransmit(device);
 	return writtenSize;
 }
 
+int uart_setTxPolicy(McuDevice_UART UARTx, enum buffer_policy policy, int recordDelimiter) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	if (buffer_setPolicy(&device->bufferTx, policy, recordDelimiter) != BUFFER_STATUS_OK) {
+		return DRIVER_STATUS_ERROR;
+	}
+	return DRIVER_STATUS_OK;
+}
+
+static inline struct circularBuffer * laneBuffer(struct uart_Peripheral * device, enum uart_lane lane) {
+	return (lane == UART_LANE_BULK) ? &device->bufferBulk : &device->bufferTx;
+}
+
+void uart_getTxStats(McuDevice_UART UARTx, enum uart_lane lane, struct buffer_stats * stats) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	buffer_getStats(laneBuffer(device, lane), stats);
+}
+
+void uart_resetTxStats(McuDevice_UART UARTx) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	buffer_resetStats(&device->bufferTx);
+	buffer_resetStats(&device->bufferBulk);
+}
+
+size_t uart_txCapacity(McuDevice_UART UARTx, enum uart_lane lane) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	return laneBuffer(device, lane)->arraySize - 1;
+}
+
+size_t uart_txFree(McuDevice_UART UARTx, enum uart_lane lane) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	struct circularBuffer * buffer = laneBuffer(device, lane);
+	
+	size_t freeSize = buffer->arraySize - 1 - buffer_size(buffer);
+	if (lane == UART_LANE_BULK) {
+		// each record also takes a slot of bulkRecords
+		size_t freeRecords = elementBuffer_capacity(&device->bulkRecords) - elementBuffer_count(&device->bulkRecords);
+		if (freeSize > freeRecords * UART_BULK_RECORD_MAX_SIZE) {
+			freeSize = freeRecords * UART_BULK_RECORD_MAX_SIZE;
+		}
+	}
+	return freeSize;
+}
+
+void uart_setRxEvent(McuDevice_UART UARTx, void (*vector)(uint32_t, void *), void * argument,
+		uint8_t priority) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	// the vector is written last, the interrupt only reads the rest when it is set
+	__atomic_store_n(&device->rxEventVector, NULL, __ATOMIC_RELAXED);
+	device->rxEventArgument = argument;
+	device->rxEventPriority = priority;
+	__atomic_store_n(&device->rxEventVector, vector, __ATOMIC_RELEASE);
+}
+
+size_t uart_available(McuDevice_UART UARTx) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	return buffer_size(&device->bufferRx);
+}
+
+uint32_t uart_getRxOverrunCount(McuDevice_UART UARTx) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	return __atomic_load_n(&device->rxOverrunCount, __ATOMIC_RELAXED);
+}
+
 size_t uart_read(McuDevice_UART UARTx, uint8_t * data, size_t size) {
 	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
 	struct circularBuffer * buffer = &device->bufferRx;
@@ -137,36 +393,377 @@ size_t uart_read(McuDevice_UART UARTx, uint8_t * data, size_t size) {
 	return buffer_dequeue(buffer, data, size);
 }
 
+static inline bool ctsDeasserted(struct uart_Peripheral * device) {
+	return device->ctsPort != NULL && (device->ctsPort->IDR & device->ctsPin) != 0;
+}
+
+bool uart_getFlowStats(McuDevice_UART UARTx, struct uart_flowStats * stats) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	if (device->ctsPort == NULL || stats == NULL) {
+		return false;
+	}
+	
+	// the counters are updated from the CTS interrupt, the current stall is added up to now
+	__disable_irq();
+	*stats = device->flowStats;
+	if (stats->stalled) {
+		uint32_t stallMicros = sysTimer_GetMicros() - device->stallStartMicros;
+		stats->stallMicrosTotal += stallMicros;
+		if (stallMicros > stats->stallMicrosMax) {
+			stats->stallMicrosMax = stallMicros;
+		}
+	}
+	__enable_irq();
+	return true;
+}
+
+void uart_resetFlowStats(McuDevice_UART UARTx) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	__disable_irq();
+	device->flowStats.stallCount = 0;
+	device->flowStats.stallMicrosMax = 0;
+	device->flowStats.stallMicrosTotal = 0;
+	device->stallStartMicros = sysTimer_GetMicros();
+	__enable_irq();
+}
+
+#ifdef UART_IRQ_PROFILING
+bool uart_getIrqStats(McuDevice_UART UARTx, struct uart_irqStats * stats) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	if (stats == NULL) {
+		return false;
+	}
+	
+	// the counters are updated from the interrupts
+	__disable_irq();
+	*stats = device->irqStats;
+	__enable_irq();
+	return true;
+}
+
+void uart_resetIrqStats(McuDevice_UART UARTx) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) UARTx;
+	
+	__disable_irq();
+	device->irqStats.count = 0;
+	device->irqStats.bytes = 0;
+	device->irqStats.cyclesTotal = 0;
+	device->irqStats.cyclesMax = 0;
+	__enable_irq();
+}
+
+static void recordIrq(struct uart_Peripheral * device, uint32_t cycles) {
+	device->irqStats.count++;
+	device->irqStats.cyclesTotal += cycles;
+	if (cycles > device->irqStats.cyclesMax) {
+		device->irqStats.cyclesMax = cycles;
+	}
+}
+#endif
+
 void USART1_IRQHandler(void) {
+	IRQ_PROFILE_START();
+	ctsChanged(&device_uart1);
+#ifdef UART_LEAN_IRQ
+	leanIrqHandler(&device_uart1);
+#else
+	receiveIdle(&device_uart1);
 	HAL_UART_IRQHandler(&device_uart1.huart);
+#endif
+	IRQ_PROFILE_END(&device_uart1);
 }
 
 void USART2_IRQHandler(void)
 {
+  IRQ_PROFILE_START();
+  ctsChanged(&device_uart2);
+#ifdef UART_LEAN_IRQ
+  leanIrqHandler(&device_uart2);
+#else
+  receiveIdle(&device_uart2);
   HAL_UART_IRQHandler(&device_uart2.huart);
+#endif
+  IRQ_PROFILE_END(&device_uart2);
+}
+
+void DMA1_Channel4_IRQHandler(void) {
+	IRQ_PROFILE_START();
+	HAL_DMA_IRQHandler(&device_uart1.hdmaTx);
+	IRQ_PROFILE_END(&device_uart1);
+}
+
+void DMA1_Channel5_IRQHandler(void) {
+	IRQ_PROFILE_START();
+	HAL_DMA_IRQHandler(&device_uart1.hdmaRx);
+	IRQ_PROFILE_END(&device_uart1);
 }
 
+void DMA1_Channel6_IRQHandler(void) {
+	IRQ_PROFILE_START();
+	HAL_DMA_IRQHandler(&device_uart2.hdmaRx);
+	IRQ_PROFILE_END(&device_uart2);
+}
+
+void DMA1_Channel7_IRQHandler(void) {
+	IRQ_PROFILE_START();
+	HAL_DMA_IRQHandler(&device_uart2.hdmaTx);
+	IRQ_PROFILE_END(&device_uart2);
+}
+
+#ifdef UART_LEAN_IRQ
+/*
+ * Register level handler, the status register is read once. Reading DR after SR clears RXNE, the 
+ * errors and IDLE. TXEIE is only changed through its bit-band alias so the main loop can set it 
+ * without a read-modify-write of CR1, it is cleared here when bufferTx is empty. TC isn't enabled,
+ * nothing is left to do when the shift register empties.
+ */
+static void leanIrqHandler(struct uart_Peripheral * device) {
+	USART_TypeDef * usart = device->huart.Instance;
+	uint32_t sr = usart->SR;
+	
+	if (sr & LEAN_RX_FLAGS) {
+		uint8_t data = (uint8_t) usart->DR;
+		if (buffer_enqueue(&device->bufferRx, &data, 1) == 1) {
+			device->rxBurstSize++;
+		} else {
+			device->rxOverrunCount++;
+		}
+		IRQ_PROFILE_BYTES(device, 1);
+	}
+	if (sr & USART_SR_IDLE) {
+		if (!(sr & LEAN_RX_FLAGS)) {
+			(void) usart->DR;
+		}
+		notifyReceived(device, device->rxBurstSize);
+		device->rxBurstSize = 0;
+	}
+	
+	if ((sr & USART_SR_TXE) && (usart->CR1 & USART_CR1_TXEIE)) {
+		uint8_t data;
+		struct circularBuffer * lane = nextLane(device);
+		if (lane != NULL && buffer_dequeue(lane, &data, 1) == 1) {
+			if (lane == &device->bufferBulk) {
+				device->bulkRemaining--;
+			}
+			usart->DR = data;
+			IRQ_PROFILE_BYTES(device, 1);
+		} else {
+			PERIPH_BITBAND(usart->CR1, USART_CR1_TXEIE_Pos) = 0;
+		}
+	}
+}
+#endif
+
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
 	struct uart_Peripheral * device = (struct uart_Peripheral *) huart;
-	struct circularBuffer * buffer = &device->bufferTx;
+	struct circularBuffer * lane = device->txLane;
 	
-	if (buffer_peekSize(buffer) > 0) {
-		buffer_advanceLinear(buffer);
-	}
-	if (buffer_size(buffer) > 0) {
-		sendBuffer(huart, buffer);
+	if (lane != NULL) {
+		size_t size = buffer_peekSize(lane);
+		IRQ_PROFILE_BYTES(device, size);
+		if (lane == &device->bufferBulk) {
+			device->bulkRemaining -= size;
+		}
+		buffer_advanceLinear(lane);
 	}
+	sendNext(device);
+}
+
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart) {
+	struct uart_Peripheral * device = (struct uart_Peripheral *) huart;
+	device->rxBurstSize += publishReceived(device, BUFFER_RX_MAX_SIZE / 2);
 }
 
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
 	struct uart_Peripheral * device = (struct uart_Peripheral *) huart;
-	struct circularBuffer * buffer = &device->bufferRx;
-	buffer_enqueue(buffer, device->memRxChar, 1);
-	HAL_UART_Receive_IT(&device->huart, device->memRxChar, 1);
+	device->rxBurstSize += publishReceived(device, 0);
+}
+
+/*
+ * Publish the data written by the receive DMA, called from the interrupts of the USART and of its 
+ * receive DMA channel. They have the same preempt priority so they never run at the same time.
+ * dmaEventPosition is the index where the DMA raised the half or full transfer interrupt, or 
+ * RX_NO_DMA_EVENT at IDLE.
+ */
+static size_t publishReceived(struct uart_Peripheral * device, size_t dmaEventPosition) {
+	size_t position = BUFFER_RX_MAX_SIZE - __HAL_DMA_GET_COUNTER(&device->hdmaRx);
+	if (position >= BUFFER_RX_MAX_SIZE) {
+		position = 0;
+	}
+	
+	// in the other half the interrupt was held for more than half a lap, the next one may be lost with it
+	if (dmaEventPosition != RX_NO_DMA_EVENT
+			&& (position + BUFFER_RX_MAX_SIZE - dmaEventPosition) % BUFFER_RX_MAX_SIZE >= BUFFER_RX_MAX_SIZE / 2) {
+		device->rxOverrunCount++;
+	}
+	size_t freeSize = (BUFFER_RX_MAX_SIZE - 1) - buffer_size(&device->bufferRx);
+	size_t received = buffer_commitIndex(&device->bufferRx, position);
+	if (received > freeSize) {
+		device->rxOverrunCount++; // the DMA wrote over data not read yet
+	}
+	IRQ_PROFILE_BYTES(device, received);
+	return received;
+}
+
+/*
+ * The IDLE flag is set when the line stays idle for a frame after a reception, it ends a burst of data.
+ * Reading SR then DR clears it. The burst includes the data already published at the half and full 
+ * transfer interrupts, a burst that ends on one of them publishes nothing more here.
+ */
+static void receiveIdle(struct uart_Peripheral * device) {
+	UART_HandleTypeDef * huart = &device->huart;
+	if (__HAL_UART_GET_FLAG(huart, UART_FLAG_IDLE) == RESET 
+			|| __HAL_UART_GET_IT_SOURCE(huart, UART_IT_IDLE) == RESET) {
+		return;
+	}
+	
+	__HAL_UART_CLEAR_IDLEFLAG(huart);
+	device->rxBurstSize += publishReceived(device, RX_NO_DMA_EVENT);
+	notifyReceived(device, device->rxBurstSize);
+	device->rxBurstSize = 0;
 }
 
-static int sendBuffer(UART_HandleTypeDef * deviceHandle, struct circularBuffer * buffer) {
+// post the receive event after a burst of data
+static void notifyReceived(struct uart_Peripheral * device, size_t received) {
+	void (*vector)(uint32_t, void *) = __atomic_load_n(&device->rxEventVector, __ATOMIC_ACQUIRE);
+	if (received > 0 && vector != NULL) {
+		scheduler_postEvent(vector, received, device->rxEventArgument, device->rxEventPriority);
+	}
+}
+
+/*
+ * The CTS flag is set on every change of the CTS input, the hal doesn't handle it. The level is read 
+ * from the pin, a stall shorter than the interrupt latency can be missed. Writing 0 clears the flag.
+ */
+static void ctsChanged(struct uart_Peripheral * device) {
+	UART_HandleTypeDef * huart = &device->huart;
+	if (device->ctsPort == NULL || __HAL_UART_GET_FLAG(huart, UART_FLAG_CTS) == RESET) {
+		return;
+	}
+	
+	__HAL_UART_CLEAR_FLAG(huart, UART_FLAG_CTS);
+	updateStall(device);
+#ifndef UART_LEAN_IRQ
+	// resume a transmission held by sendNext(), unless holdTransmit() took it back first
+	struct circularBuffer * held = &txLaneHeld;
+	if (!device->flowStats.stalled && __atomic_compare_exchange_n(&device->txLane, &held, NULL, false, 
+			__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		sendNext(device);
+	}
+#endif
+}
+
+// start or end the current stall from the CTS level
+static void updateStall(struct uart_Peripheral * device) {
+	uint32_t now = sysTimer_GetMicros();
+	bool deasserted = ctsDeasserted(device);
+	
+	if (deasserted && !device->flowStats.stalled) {
+		device->flowStats.stalled = true;
+		device->flowStats.stallCount++;
+		device->stallStartMicros = now;
+	} else if (!deasserted && device->flowStats.stalled) {
+		uint32_t stallMicros = now - device->stallStartMicros;
+		device->flowStats.stalled = false;
+		device->flowStats.stallMicrosTotal += stallMicros;
+		if (stallMicros > device->flowStats.stallMicrosMax) {
+			device->flowStats.stallMicrosMax = stallMicros;
+		}
+	}
+}
+
+/*
+ * The main loop is the producer of the lanes but it also starts the transmission when the interrupt
+ * side is idle. The fence keeps the enqueue before the read of txLane: if the transmit complete
+ * interrupt comes after the enqueue it sends the new data itself, else txLane is NULL here.
+ */
+static void startTransmit(struct uart_Peripheral * device) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#ifdef UART_LEAN_IRQ
+	// the TXE interrupt sends the lanes until they are empty
+	if (buffer_size(&device->bufferTx) > 0 || elementBuffer_count(&device->bulkRecords) > 0) {
+		PERIPH_BITBAND(device->huart.Instance->CR1, USART_CR1_TXEIE_Pos) = 1;
+	}
+#else
+	// send the lanes if nothing is waiting to send
+	if (__atomic_load_n(&device->txLane, __ATOMIC_RELAXED) == NULL) {
+		sendNext(device);
+	}
+#endif
+}
+
+/*
+ * Lane of the next data to send, transmit side. The current bulk record is always finished first, then
+ * the urgent lane has the priority. Returns NULL if both lanes are empty.
+ */
+static struct circularBuffer * nextLane(struct uart_Peripheral * device) {
+	if (device->bulkRemaining > 0) {
+		return &device->bufferBulk;
+	}
+	if (buffer_size(&device->bufferTx) > 0) {
+		return &device->bufferTx;
+	}
+	
+	uint16_t length;
+	if (elementBuffer_pop(&device->bulkRecords, &length, 1) == 1) {
+		device->bulkRemaining = length;
+		return &device->bufferBulk;
+	}
+	return NULL;
+}
+
+/*
+ * Start sending the next linear segment, from the transmit complete interrupt or from the main loop 
+ * when the transmission is idle. A bulk segment stops at the end of its record. Nothing is started 
+ * while CTS is deasserted. If the hal refuses the segment the transmission goes back to idle, txLane 
+ * is NULL and not txLaneHeld, so the next write starts it again.
+ */
+static void sendNext(struct uart_Peripheral * device) {
+	if (ctsDeasserted(device) && !holdTransmit(device)) {
+		return;
+	}
+	
+	struct circularBuffer * lane = nextLane(device);
 	uint8_t * data;
-	size_t size = buffer_peekLinear(buffer, &data);
-	return HAL_UART_Transmit_IT(deviceHandle, data, size);
+	size_t size = 0;
+	if (lane != NULL) {
+		size_t maxSize = (lane == &device->bufferBulk) ? device->bulkRemaining : SIZE_MAX;
+		size = buffer_peekLinearUpTo(lane, &data, maxSize);
+	}
+	if (size == 0) {
+		__atomic_store_n(&device->txLane, NULL, __ATOMIC_RELAXED);
+		return;
+	}
+	
+	__atomic_store_n(&device->txLane, lane, __ATOMIC_RELAXED);
+#ifdef UART_TX_IT
+	HAL_StatusTypeDef status = HAL_UART_Transmit_IT(&device->huart, data, size);
+#else
+	HAL_StatusTypeDef status = HAL_UART_Transmit_DMA(&device->huart, data, size);
+	if (status == HAL_OK) {
+		// the hal enables the half transfer interrupt, it is of no use for a whole segment
+		__HAL_DMA_DISABLE_IT(&device->hdmaTx, DMA_IT_HT);
+	}
+#endif
+	if (status != HAL_OK) {
+		// no transmit complete callback will come, the segment stays queued for the next write to retry
+		__atomic_store_n(&device->txLane, NULL, __ATOMIC_RELAXED);
+	}
+}
+
+/*
+ * Hold the transmission until the CTS interrupt resumes it. CTS is read again after txLane is set in 
+ * case it was asserted before, the interrupt then saw no held transmission. Whichever of this call and
+ * the interrupt takes txLane back from txLaneHeld sends the next segment, returns true if it is this call.
+ */
+static bool holdTransmit(struct uart_Peripheral * device) {
+	__atomic_store_n(&device->txLane, &txLaneHeld, __ATOMIC_SEQ_CST);
+	if (ctsDeasserted(device)) {
+		return false;
+	}
+	
+	struct circularBuffer * held = &txLaneHeld;
+	return __atomic_compare_exchange_n(&device->txLane, &held, NULL, false, __ATOMIC_SEQ_CST, 
+			__ATOMIC_RELAXED);
 }
@@ -44,3 +44,28 @@ int xbee_write(uint8_t * data, size_t size) {
 	uart_write(xbeeUartDevice, data, size);
 	return DRIVER_STATUS_OK;
 }
+
+size_t xbee_writeBulk(uint8_t * data, size_t size) {
+	if (xbeeUartDevice == NULL) {
+		return 0;
+	}
+	return uart_writeBulk(xbeeUartDevice, data, size);
+}
+
+size_t xbee_bulkFree(void) {
+	if (xbeeUartDevice == NULL) {
+		return 0;
+	}
+	return uart_txFree(xbeeUartDevice, UART_LANE_BULK);
+}
+
+int xbee_writev(const struct buffer_segment * segments, size_t count) {
+	if (xbeeUartDevice == NULL) {
+		logging_send("xbee write uart device is null", MODULE_INDEX_XBEE, LOG_WARNING);
+		return DRIVER_STATUS_ERROR;
+	}
+	if (uart_writev(xbeeUartDevice, segments, count) == 0 && count > 0) {
+		return DRIVER_STATUS_ERROR;
+	}
+	return DRIVER_STATUS_OK;
+}